@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+#include "parallel.hpp"
+
+struct ApproximateMatch
+{
+	std::string substring;
+	int distance;
+};
+
+// Finds the distinct substrings of the text within Hamming or edit distance k of a pattern.
+// Every path from the source spells a distinct substring, so a depth-first search over the
+// automaton visits each candidate once instead of scanning the text. The search along a path
+// carries the pattern's distances to the path's string and abandons the path as soon as no
+// extension of it can get back under k. The subtrees of the source's outgoing edges are
+// searched in parallel, and the matches are returned sorted.
+template <typename CharType>
+class ApproximateMatcher
+{
+public:
+	static const int max_pattern_length = 64;
+
+	ApproximateMatcher(const Dawg<CharType>& dawg, int thread_count) : source(dawg.get_source_node()), thread_count(thread_count)
+	{
+	}
+
+	// Substrings of the pattern's length with at most k mismatches
+	bool find_mismatches(const char* const pattern, int k, std::vector<ApproximateMatch>& result)
+	{
+		if (set_pattern(pattern) == false)
+		{
+			return false;
+		}
+		search(result, [this, k](AllocatorPtr<Node<CharType>> node, CharType letter, std::string& substring, std::vector<ApproximateMatch>& matches)
+		{
+			search_mismatches(node, letter, 0, k, substring, matches);
+		});
+		return true;
+	}
+
+	// Substrings with a Levenshtein distance of at most k from the pattern
+	bool find_edits(const char* const pattern, int k, std::vector<ApproximateMatch>& result)
+	{
+		if (set_pattern(pattern) == false)
+		{
+			return false;
+		}
+		search(result, [this, k](AllocatorPtr<Node<CharType>> node, CharType letter, std::string& substring, std::vector<ApproximateMatch>& matches)
+		{
+			EditColumn column;
+			column.positive = pattern_mask;
+			column.negative = 0;
+			column.distance = pattern_length;
+			search_edits(node, letter, column, k, substring, matches);
+		});
+		return true;
+	}
+private:
+	// The vertical differences of a column of the edit distance matrix (Myers, 1999), for the
+	// string spelled so far against every prefix of the pattern, and its last entry
+	struct EditColumn
+	{
+		unsigned long long positive;
+		unsigned long long negative;
+		int distance;
+	};
+
+	bool set_pattern(const char* const pattern)
+	{
+		pattern_length = strlen(pattern);
+		if (pattern_length == 0 || pattern_length > max_pattern_length)
+		{
+			return false;
+		}
+
+		pattern_letters.clear();
+		std::fill(letter_masks, letter_masks + 32, 0ULL);
+		for (int i = 0; i < pattern_length; i++)
+		{
+			const CharType letter = Dawg<CharType>::to_letter(pattern[i]);
+			pattern_letters.push_back(letter);
+			letter_masks[(int)letter] |= 1ULL << i;
+		}
+		pattern_mask = pattern_length == 64 ? ~0ULL : (1ULL << pattern_length) - 1;
+		return true;
+	}
+
+	// Runs search_edge(child, label, substring, matches) for every outgoing edge of the source
+	template <typename Function>
+	void search(std::vector<ApproximateMatch>& result, Function search_edge)
+	{
+		std::vector<LabeledEdge<CharType>> edges;
+		source->for_each_edge([&edges](const LabeledEdge<CharType> edge)
+		{
+			edges.push_back(edge);
+		});
+
+		std::vector<std::vector<ApproximateMatch>> edge_matches(edges.size());
+		parallel_for(0, edges.size(), std::max(1, std::min<int>(thread_count, edges.size())), [&](int, int begin, int end)
+		{
+			std::string substring;
+			for (int i = begin; i < end; i++)
+			{
+				search_edge(edges[i].edge.get_exit_node(), edges[i].label, substring, edge_matches[i]);
+			}
+		});
+
+		result.clear();
+		for (const std::vector<ApproximateMatch>& matches : edge_matches)
+		{
+			result.insert(result.end(), matches.begin(), matches.end());
+		}
+		std::sort(result.begin(), result.end(), [](const ApproximateMatch& first, const ApproximateMatch& second)
+		{
+			return first.substring < second.substring;
+		});
+	}
+
+	// Once k mismatches are used up, only the edge that matches the pattern is followed
+	void search_mismatches(AllocatorPtr<Node<CharType>> node, CharType letter, int mismatches, int k, std::string& substring, std::vector<ApproximateMatch>& matches) const
+	{
+		const int depth = substring.size();
+		mismatches += letter != pattern_letters[depth];
+		if (mismatches > k)
+		{
+			return;
+		}
+
+		substring.push_back(0x60 | letter);
+		if (depth + 1 == pattern_length)
+		{
+			matches.push_back(ApproximateMatch { substring, mismatches });
+		}
+		else if (mismatches == k)
+		{
+			const CharType next_letter = pattern_letters[depth + 1];
+			const Edge<CharType> edge = node->get_outgoing_edge(next_letter);
+			if (edge.is_present())
+			{
+				search_mismatches(edge.get_exit_node(), next_letter, mismatches, k, substring, matches);
+			}
+		}
+		else
+		{
+			node->for_each_edge([this, mismatches, k, &substring, &matches](const LabeledEdge<CharType> edge)
+			{
+				search_mismatches(edge.edge.get_exit_node(), edge.label, mismatches, k, substring, matches);
+			});
+		}
+		substring.pop_back();
+	}
+
+	void search_edits(AllocatorPtr<Node<CharType>> node, CharType letter, EditColumn column, int k, std::string& substring, std::vector<ApproximateMatch>& matches) const
+	{
+		substring.push_back(0x60 | letter);
+		const int depth = substring.size();
+		advance(column, letter);
+		if (column.distance <= k)
+		{
+			matches.push_back(ApproximateMatch { substring, column.distance });
+		}
+
+		// Every alignment of a longer string passes through this column, and the distances never
+		// decrease along an alignment, so the column's minimum bounds the distance of any extension
+		if (depth < pattern_length + k && get_minimum(column, depth) <= k)
+		{
+			node->for_each_edge([this, &column, k, &substring, &matches](const LabeledEdge<CharType> edge)
+			{
+				search_edits(edge.edge.get_exit_node(), edge.label, column, k, substring, matches);
+			});
+		}
+		substring.pop_back();
+	}
+
+	// One step of Myers' algorithm with the top row of the matrix counting up (Hyyrö, 2001),
+	// which gives the global distance instead of the best match ending anywhere in the string
+	void advance(EditColumn& column, CharType letter) const
+	{
+		const unsigned long long equal = letter_masks[(int)letter];
+		const unsigned long long vertical = equal | column.negative;
+		const unsigned long long horizontal = (((equal & column.positive) + column.positive) ^ column.positive) | equal;
+		unsigned long long positive_horizontal = column.negative | ~(horizontal | column.positive);
+		unsigned long long negative_horizontal = column.positive & horizontal;
+
+		const int last_row = pattern_length - 1;
+		column.distance += (positive_horizontal >> last_row) & 1;
+		column.distance -= (negative_horizontal >> last_row) & 1;
+
+		positive_horizontal = positive_horizontal << 1 | 1;
+		negative_horizontal = negative_horizontal << 1;
+		column.positive = (negative_horizontal | ~(vertical | positive_horizontal)) & pattern_mask;
+		column.negative = positive_horizontal & vertical & pattern_mask;
+	}
+
+	int get_minimum(const EditColumn& column, int depth) const
+	{
+		int result = depth;
+		int distance = depth;
+		for (int i = 0; i < pattern_length; i++)
+		{
+			distance += (int)((column.positive >> i) & 1) - (int)((column.negative >> i) & 1);
+			result = std::min(result, distance);
+		}
+		return result;
+	}
+
+	const AllocatorPtr<Node<CharType>> source;
+	const int thread_count;
+	int pattern_length;
+	std::vector<CharType> pattern_letters;
+	unsigned long long letter_masks[32];
+	unsigned long long pattern_mask;
+};
@@ -1,11 +1,30 @@
 #include <cassert>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "memory.hpp"
 #include "nodes.hpp"
 #include "dawg.hpp"
+#include "sliding-window.hpp"
+#include "truncated.hpp"
+#include "lz77.hpp"
+#include "frozen.hpp"
+#include "checkpoint.hpp"
+#include "dictionary.hpp"
+#include "approximate.hpp"
+#include "genome.hpp"
+#include "minimal-words.hpp"
+#include "concurrent.hpp"
+#include "ppm.hpp"
 
 class NodeStatsBuilder
 {
@@ -44,6 +63,16 @@ public:
 		printf("%d\n", branched_nodes + 1);
 	}
 
+	int get_count(int edge_count) const
+	{
+		return counts[edge_count];
+	}
+
+	int get_branched_nodes() const
+	{
+		return branched_nodes;
+	}
+
 private:
 	int counts[27];
 	int branched_nodes;
@@ -55,14 +84,54 @@ private:
 #ifdef WIN32
 #include <io.h>
 
+bool list_directory(const std::string& path, std::vector<std::string>& result)
+{
+	_finddata_t entry;
+	intptr_t handle = _findfirst((path + "\\*").c_str(), &entry);
+	if (handle == -1)
+	{
+		return false;
+	}
+	do
+	{
+		if ((entry.attrib & _A_SUBDIR) == 0)
+		{
+			result.push_back(path + "\\" + entry.name);
+		}
+	} while (_findnext(handle, &entry) == 0);
+	_findclose(handle);
+	return true;
+}
+
 int open_sequential_read(const char* const filename)
 {
 	int fd = open(filename, O_RDONLY | O_BINARY | O_SEQUENTIAL);
 	return fd;
 }
 #else
+#include <dirent.h>
 #include <unistd.h>
 
+bool list_directory(const std::string& path, std::vector<std::string>& result)
+{
+	DIR* directory = opendir(path.c_str());
+	if (directory == 0)
+	{
+		return false;
+	}
+	while (dirent* entry = readdir(directory))
+	{
+		const std::string entry_path = path + "/" + entry->d_name;
+		struct stat entry_stats;
+		if (stat(entry_path.c_str(), &entry_stats) == 0 && (entry_stats.st_mode & S_IFMT) == S_IFREG)
+		{
+			result.push_back(entry_path);
+		}
+	}
+	closedir(directory);
+	return true;
+}
+
 int open_sequential_read(const char* const filename)
 {
 	int fd = open(filename, O_RDONLY);
@@ -74,6 +143,10 @@ int open_sequential_read(const char* const filename)
 char* read_input(const char* const filename)
 {
 	int input_fd = open_sequential_read(filename);
+	if (input_fd == -1)
+	{
+		return 0;
+	}
 
 	struct stat input_file_stats;
 	fstat(input_fd, &input_file_stats);
@@ -86,22 +159,647 @@ char* read_input(const char* const filename)
 	return result;
 }
 
+// Greedily cuts the input in phrases that are each the longest prefix of the rest (at most
+// window_size letters) occurring in the window before it, or a single letter, and prints the
+// position and length of every phrase of at least min_length letters
+void slide_window(const char* const filename, int window_size, int min_length)
+{
+	int input_fd = strcmp(filename, "-") == 0 ? 0 : open_sequential_read(filename);
+
+	SlidingWindowDawg<char> dawg(window_size);
+	std::vector<char> phrase;
+	long long phrase_start = 0;
+	auto end_phrase = [&dawg, &phrase, &phrase_start, min_length]()
+	{
+		if ((int)phrase.size() >= min_length)
+		{
+			printf("%lld %d\n", phrase_start, (int)phrase.size());
+		}
+		for (const char letter : phrase)
+		{
+			dawg.append(letter);
+		}
+		phrase_start += phrase.size();
+		phrase.clear();
+		dawg.begin_match();
+	};
+
+	char buffer[64 * 1024];
+	int size;
+	while ((size = read(input_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			const char letter = Dawg<char>::to_letter(buffer[i]);
+			if ((int)phrase.size() == window_size || dawg.extend_match(letter) == false)
+			{
+				end_phrase();
+				if (dawg.extend_match(letter) == false)
+				{
+					// A literal, not a repeat
+					dawg.append(letter);
+					++phrase_start;
+					dawg.begin_match();
+					continue;
+				}
+			}
+			phrase.push_back(letter);
+		}
+	}
+	end_phrase();
+	close(input_fd);
+}
+
+bool build_truncated(const char* const filename, int max_length)
+{
+	if (max_length < 1 || max_length > TruncatedDawg<char>::length_limit)
+	{
+		fprintf(stderr, "The subword length must be between 1 and %d\n", TruncatedDawg<char>::length_limit);
+		return false;
+	}
+	int input_fd = strcmp(filename, "-") == 0 ? 0 : open_sequential_read(filename);
+
+	TruncatedDawg<char> dawg(max_length);
+	char buffer[64 * 1024];
+	int size;
+	while ((size = read(input_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			dawg.append(Dawg<char>::to_letter(buffer[i]));
+		}
+	}
+	close(input_fd);
+
+	printf("%d\n", Allocator<Node<char>>::get_instance().get_allocations_count() - 1);
+	return true;
+}
+
+class PhrasePrinter
+{
+public:
+	void operator()(const Lz77Phrase& phrase)
+	{
+		if (phrase.length == 0)
+		{
+			printf("0 %d\n", (unsigned char)phrase.literal);
+		}
+		else
+		{
+			printf("%d %d\n", phrase.offset, phrase.length);
+		}
+	}
+};
+
+bool build_with_checkpoints(const char* const content, const char* const checkpoint_filename, int interval)
+{
+	if (interval <= 0)
+	{
+		fprintf(stderr, "The checkpoint interval must be positive\n");
+		return false;
+	}
+
+	const int input_length = strlen(content);
+	Checkpointer<char> checkpointer(checkpoint_filename);
+	CheckpointState state;
+	const bool resumed = checkpointer.resume(content, input_length, state);
+	Dawg<char> dawg = resumed ? Dawg<char>(state.source_node, state.active_node) : Dawg<char>();
+	const int start = resumed ? state.input_offset : 0;
+	for (int position = start; position < input_length; ++position)
+	{
+		if (position > start && position % interval == 0)
+		{
+			checkpointer.save(dawg, content, input_length, position);
+		}
+		dawg.append(Dawg<char>::to_letter(content[position]), checkpointer);
+	}
+
+	const bool result = checkpointer.finish();
+	if (result == false)
+	{
+		fprintf(stderr, "Could not write %s\n", checkpoint_filename);
+	}
+	remove(checkpoint_filename);
+	return result;
+}
+
+// A directory stands for the regular files in it; any other path is a file with one input filename per line
+bool list_inputs(const char* const path, std::vector<std::string>& inputs)
+{
+	struct stat path_stats;
+	if (stat(path, &path_stats) == 0 && (path_stats.st_mode & S_IFMT) == S_IFDIR)
+	{
+		if (list_directory(path, inputs) == false)
+		{
+			return false;
+		}
+		std::sort(inputs.begin(), inputs.end());
+		return true;
+	}
+
+	FILE* list_file = fopen(path, "r");
+	if (list_file == 0)
+	{
+		return false;
+	}
+	char line[4096];
+	while (fgets(line, sizeof(line), list_file))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0])
+		{
+			inputs.push_back(line);
+		}
+	}
+	const bool result = ferror(list_file) == 0;
+	fclose(list_file);
+	return result;
+}
+
+// The allocators of one batch worker. They serve every allocation on the worker's thread
+// and are reset between files, so all files after the first reuse the same chunks.
+class WorkerAllocators
+{
+public:
+	WorkerAllocators()
+	{
+		Allocator<Node<char>>::bind_to_thread(&nodes);
+		Allocator<PartialEdgeList<char>>::bind_to_thread(&partial_lists);
+		Allocator<FullEdgeMap<char, 26>>::bind_to_thread(&full_maps);
+	}
+
+	~WorkerAllocators()
+	{
+		Allocator<Node<char>>::bind_to_thread(0);
+		Allocator<PartialEdgeList<char>>::bind_to_thread(0);
+		Allocator<FullEdgeMap<char, 26>>::bind_to_thread(0);
+	}
+
+	void reset()
+	{
+		nodes.reset();
+		partial_lists.reset();
+		full_maps.reset();
+	}
+private:
+	Allocator<Node<char>> nodes;
+	Allocator<PartialEdgeList<char>> partial_lists;
+	Allocator<FullEdgeMap<char, 26>> full_maps;
+};
+
+void append_json_string(std::string& output, const std::string& value)
+{
+	output += '"';
+	for (const char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			output += '\\';
+			output += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			sprintf(escaped, "\\u%04x", c);
+			output += escaped;
+		}
+		else
+		{
+			output += c;
+		}
+	}
+	output += '"';
+}
+
+// Builds the automaton of one file and describes it as a line of JSON
+void index_file(const std::string& filename, std::string& output)
+{
+	output += "{\"file\": ";
+	append_json_string(output, filename);
+
+	char* const content = read_input(filename.c_str());
+	if (content == 0)
+	{
+		output += ", \"error\": \"cannot read the file\"}\n";
+		return;
+	}
+	{
+		Dawg<char> dawg(content);
+	}
+	free(content);
+
+	NodeStatsBuilder stats;
+	stats.build();
+	output += ", \"nodes\": " + std::to_string(Allocator<Node<char>>::get_instance().get_allocations_count() - 1);
+	output += ", \"partial_edge_lists\": " + std::to_string(Allocator<PartialEdgeList<char>>::get_instance().get_allocations_count() - 1);
+	output += ", \"full_edge_maps\": " + std::to_string(Allocator<FullEdgeMap<char, 26>>::get_instance().get_allocations_count() - 1);
+	output += ", \"branched_nodes\": " + std::to_string(stats.get_branched_nodes());
+	output += ", \"edge_counts\": [";
+	for (int i = 0; i < 27; ++i)
+	{
+		output += i ? ", " : "";
+		output += std::to_string(stats.get_count(i));
+	}
+	output += "]}\n";
+}
+
+// Indexes many files in one process. Each worker takes the next file from a shared counter,
+// and whole lines are written to stdout under a lock, so the output stays one object per line.
+bool index_batch(const char* const path, int thread_count)
+{
+	if (thread_count < 1)
+	{
+		fprintf(stderr, "The thread count must be positive\n");
+		return false;
+	}
+	std::vector<std::string> inputs;
+	if (list_inputs(path, inputs) == false)
+	{
+		fprintf(stderr, "Could not read %s\n", path);
+		return false;
+	}
+	std::atomic<int> next_input(0);
+	std::mutex output_mutex;
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < thread_count; i++)
+	{
+		workers.push_back(std::thread([&inputs, &next_input, &output_mutex]()
+		{
+			WorkerAllocators allocators;
+			std::string output;
+			for (int input = next_input++; input < (int)inputs.size(); input = next_input++)
+			{
+				output.clear();
+				index_file(inputs[input], output);
+				allocators.reset();
+
+				std::lock_guard<std::mutex> lock(output_mutex);
+				fputs(output.c_str(), stdout);
+			}
+		}));
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	return true;
+}
+
+// Reads a sorted word list, one word per line, and prints the word and node counts of its
+// minimal automaton, followed by the words starting with the prefix if there is one. The list is
+// read in chunks, so that only the automaton and the current word are kept in memory.
+bool build_dictionary(const char* const filename, const char* const prefix)
+{
+	const int input_fd = open_sequential_read(filename);
+	if (input_fd == -1)
+	{
+		fprintf(stderr, "Could not read %s\n", filename);
+		return false;
+	}
+
+	Dictionary<char> dictionary;
+	std::string word;
+	bool result = true;
+	auto end_word = [&dictionary, &word, &result]()
+	{
+		if (word.empty() == false && word.back() == '\r')
+		{
+			word.pop_back();
+		}
+		if (Dictionary<char>::is_word(word.data(), word.size()) == false)
+		{
+			fprintf(stderr, "The word has characters other than lowercase letters: %s\n", word.c_str());
+			result = false;
+		}
+		else if (word.empty() == false && dictionary.add_word(word.data(), word.size()) == false)
+		{
+			fprintf(stderr, "The words are not sorted: %s\n", word.c_str());
+			result = false;
+		}
+		word.clear();
+	};
+
+	char buffer[64 * 1024];
+	int size = 0;
+	while (result && (size = read(input_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (int i = 0; i < size && result; i++)
+		{
+			if (buffer[i] == '\n')
+			{
+				end_word();
+			}
+			else
+			{
+				word.push_back(buffer[i]);
+			}
+		}
+	}
+	close(input_fd);
+	if (size < 0)
+	{
+		fprintf(stderr, "Could not read %s\n", filename);
+		return false;
+	}
+	if (result)
+	{
+		end_word(); // the last line may have no newline
+	}
+	if (result == false)
+	{
+		return false;
+	}
+	dictionary.finish();
+
+	printf("%d %d\n", dictionary.get_word_count(), dictionary.get_node_count());
+	if (prefix)
+	{
+		dictionary.for_each_word(prefix, [](const std::string& word)
+		{
+			puts(word.c_str());
+		});
+	}
+	return true;
+}
+
+// Prints the distinct substrings within k mismatches (or k edits) of the pattern, with their distances
+bool print_approximate_matches(const char* const content, const char* const pattern, int k, bool edits)
+{
+	Dawg<char> dawg(content);
+	ApproximateMatcher<char> matcher(dawg, default_thread_count());
+	std::vector<ApproximateMatch> matches;
+	const bool result = edits ? matcher.find_edits(pattern, k, matches) : matcher.find_mismatches(pattern, k, matches);
+	if (result == false)
+	{
+		fprintf(stderr, "The pattern must have 1 to %d letters\n", ApproximateMatcher<char>::max_pattern_length);
+		return false;
+	}
+	for (const ApproximateMatch& match : matches)
+	{
+		printf("%s %d\n", match.substring.c_str(), match.distance);
+	}
+	return true;
+}
+
+// Builds one automaton of all the sequences in a FASTA file, with 2-bit letters and
+// 4-edge nodes, and prints the base, segment and node counts
+bool build_genome(const char* const filename)
+{
+	Dawg<Nucleotide> dawg;
+	FastaReader reader;
+	if (reader.read_file(filename, dawg) == false)
+	{
+		fprintf(stderr, "Could not read %s\n", filename);
+		return false;
+	}
+	printf("%lld %d %d\n", reader.get_base_count(), reader.get_segment_count(), Allocator<Node<Nucleotide>>::get_instance().get_allocations_count() - 1);
+	return true;
+}
+
+// Prints the minimal absent words (or the minimal unique substrings) of the text, one per line
+void print_minimal_words(const char* const content, bool unique, int min_length, int max_length)
+{
+	Dawg<char> dawg(content);
+	MinimalWords<char> words(dawg, default_thread_count());
+	auto print = [](const char* word, int length)
+	{
+		fwrite(word, 1, length, stdout);
+		putchar('\n');
+	};
+	if (unique)
+	{
+		words.for_each_unique_substring(min_length, max_length, print);
+	}
+	else
+	{
+		words.for_each_absent_word(min_length, max_length, print);
+	}
+}
+
+// Appends the input while reader threads keep querying the patterns (one per line), then prints
+// each pattern with the text length at which a reader first found it, or -1
+bool query_while_building(const char* const content, const char* const patterns_filename, int reader_count)
+{
+	char* const patterns_content = read_input(patterns_filename);
+	if (patterns_content == 0)
+	{
+		fprintf(stderr, "Could not read %s\n", patterns_filename);
+		return false;
+	}
+	std::vector<std::string> patterns;
+	for (char* pattern = strtok(patterns_content, "\r\n"); pattern; pattern = strtok(0, "\r\n"))
+	{
+		patterns.push_back(pattern);
+	}
+	free(patterns_content);
+
+	ConcurrentDawg<char> dawg;
+	std::vector<int> found_at(patterns.size(), -1);
+	std::atomic<bool> is_done(false);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < reader_count; r++)
+	{
+		readers.emplace_back([&dawg, &patterns, &found_at, &is_done, r, reader_count]()
+		{
+			ConcurrentDawg<char>::Reader reader(dawg);
+			std::vector<char> letters;
+			bool is_last_pass = false;
+			while (is_last_pass == false)
+			{
+				// One more pass after the writer is done sees the whole text
+				is_last_pass = is_done.load();
+				for (size_t i = r; i < patterns.size(); i += reader_count)
+				{
+					if (found_at[i] == -1)
+					{
+						letters.clear();
+						for (const char c : patterns[i])
+						{
+							letters.push_back(Dawg<char>::to_letter(c));
+						}
+						if (reader.contains(letters.data(), letters.size()))
+						{
+							found_at[i] = reader.get_snapshot_length();
+						}
+					}
+				}
+				std::this_thread::yield();
+			}
+		});
+	}
+	for (const char* c = content; *c; c++)
+	{
+		dawg.append(Dawg<char>::to_letter(*c));
+	}
+	is_done.store(true);
+	for (std::thread& reader : readers)
+	{
+		reader.join();
+	}
+
+	for (size_t i = 0; i < patterns.size(); i++)
+	{
+		printf("%s %d\n", patterns[i].c_str(), found_at[i]);
+	}
+	return true;
+}
+
+// Prints the estimated code length of the input in bits and bits per letter, preceded by the
+// bits per letter of every block of block_size letters if there is a block size
+void estimate_compressibility(const char* const content, int block_size)
+{
+	PpmEstimator<char> estimator;
+	double block_bits = 0;
+	int block_length = 0;
+	for (const char* c = content; *c; c++)
+	{
+		block_bits += estimator.append(Dawg<char>::to_letter(*c));
+		if (++block_length == block_size)
+		{
+			printf("%.4f\n", block_bits / block_length);
+			block_bits = 0;
+			block_length = 0;
+		}
+	}
+	if (block_size > 0 && block_length > 0)
+	{
+		printf("%.4f\n", block_bits / block_length);
+	}
+	printf("%.0f %.4f\n", estimator.get_total_bits(), estimator.get_bits_per_letter());
+}
+
 void test()
 {
 #ifndef NDEBUG
 	PartialEdgeList<char, 3> lists[2];
 	assert(sizeof(lists) == 32);
 
+	Node<Nucleotide> genome_nodes[2];
+	assert(sizeof(genome_nodes) == 16);
+
 	Node<char> nodes[2];
+#ifdef WIDE_NODES
+	assert(sizeof(nodes) == 64);
+#else
 	assert(sizeof(nodes) == 16);
 #endif
+
+	// Repeated text costs next to nothing, and random text no more than the uniform code
+	{
+		PpmEstimator<char> repeated;
+		for (int i = 0; i < 100000; i++)
+		{
+			repeated.append(Dawg<char>::to_letter("abc"[i % 3]));
+		}
+		assert(repeated.get_bits_per_letter() < 0.01);
+	}
+	{
+		PpmEstimator<char> random;
+		unsigned int seed = 1;
+		for (int i = 0; i < 100000; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			random.append(1 + (seed >> 16) % PpmEstimator<char>::alphabet_size);
+		}
+		assert(random.get_bits_per_letter() <= std::log2((double)PpmEstimator<char>::alphabet_size) + 0.001);
+	}
+#endif
 }
 
 int main(int argc, char* argv[])
 {
 	const char* input_filename = argv[1];
+	if (argc > 2 && strcmp(argv[2], "-b") == 0)
+	{
+		return index_batch(input_filename, argc > 3 ? atoi(argv[3]) : default_thread_count()) ? 0 : 1;
+	}
+
+	if (argc > 2 && strcmp(argv[2], "-d") == 0)
+	{
+		return build_dictionary(input_filename, argc > 3 ? argv[3] : 0) ? 0 : 1;
+	}
+
+	if (argc > 2 && strcmp(argv[2], "-g") == 0)
+	{
+		return build_genome(input_filename) ? 0 : 1;
+	}
+
+	if (argc > 3 && strcmp(argv[2], "-w") == 0)
+	{
+		slide_window(input_filename, atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 16);
+		return 0;
+	}
+
+	if (argc > 3 && strcmp(argv[2], "-k") == 0)
+	{
+		return build_truncated(input_filename, atoi(argv[3])) ? 0 : 1;
+	}
+
 	char* const content = read_input(input_filename);
-	Dawg<char> dawg(content);
+	if (argc > 2 && strcmp(argv[2], "-z") == 0)
+	{
+		PhrasePrinter printer;
+		Lz77Factorizer<char>().factorize(content, printer);
+		free(content);
+		return 0;
+	}
+
+	if (argc > 4 && (strcmp(argv[2], "-m") == 0 || strcmp(argv[2], "-e") == 0))
+	{
+		const bool result = print_approximate_matches(content, argv[3], atoi(argv[4]), argv[2][1] == 'e');
+		free(content);
+		return result ? 0 : 1;
+	}
+
+	if (argc > 2 && (strcmp(argv[2], "-a") == 0 || strcmp(argv[2], "-u") == 0))
+	{
+		print_minimal_words(content, argv[2][1] == 'u', argc > 4 ? atoi(argv[3]) : 0, argc > 4 ? atoi(argv[4]) : INT_MAX);
+		free(content);
+		return 0;
+	}
+
+	if (argc > 2 && strcmp(argv[2], "-p") == 0)
+	{
+		estimate_compressibility(content, argc > 3 ? atoi(argv[3]) : 0);
+		free(content);
+		return 0;
+	}
+
+	if (argc > 3 && strcmp(argv[2], "-q") == 0)
+	{
+		const bool result = query_while_building(content, argv[3], argc > 4 ? atoi(argv[4]) : default_thread_count());
+		free(content);
+		return result ? 0 : 1;
+	}
+
+	if (argc > 3 && strcmp(argv[2], "-f") == 0)
+	{
+		Dawg<char> dawg(content);
+		free(content);
+		FrozenDawg<char> frozen;
+		frozen.freeze(dawg, default_thread_count());
+		if (frozen.write(argv[3]) == false)
+		{
+			fprintf(stderr, "Could not write %s\n", argv[3]);
+			return 1;
+		}
+		printf("%d %d\n", frozen.get_node_count(), frozen.get_edge_count());
+		return 0;
+	}
+
+	if (argc > 3 && strcmp(argv[2], "-c") == 0)
+	{
+		if (build_with_checkpoints(content, argv[3], argc > 4 ? atoi(argv[4]) : 1 << 24) == false)
+		{
+			free(content);
+			return 1;
+		}
+	}
+	else
+	{
+		Dawg<char> dawg(content);
+	}
 	free(content);
 
 	const char* verbose_arg = argv[2];
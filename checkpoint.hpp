@@ -0,0 +1,448 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+
+enum CheckpointRecordType
+{
+	block_record = 0x4b434c42, // "BLCK"
+	commit_record = 0x54494d43, // "CMIT"
+};
+
+struct CheckpointRecord
+{
+	int type;
+	int allocator;
+	int first_item;
+	int item_count;
+};
+
+struct CheckpointState
+{
+	unsigned long long input_hash; // of the input_offset letters appended so far
+	int input_length;
+	int input_offset;
+	int source_node;
+	int active_node;
+	int node_size;
+	int is_wide;
+};
+
+struct CheckpointCommit
+{
+	CheckpointState state;
+	int reserved_counts[3];
+	int allocations_counts[3];
+	int free_list_heads[3];
+};
+
+// Saves the blocks of an allocator's items that were allocated or marked as changed since they
+// were last saved (see ChunkedAllocator::mark_changed)
+template <typename T>
+class AllocatorSnapshot
+{
+public:
+	static const int block_size = Allocator<T>::change_block_size;
+
+	AllocatorSnapshot() : saved_count(0)
+	{
+		Allocator<T>::get_instance().set_tracking_changes(true);
+	}
+
+	~AllocatorSnapshot()
+	{
+		Allocator<T>::get_instance().set_tracking_changes(false);
+	}
+
+	// Appends a block record for every block that changed since the previous call
+	void collect(int allocator_id, std::vector<char>& buffer)
+	{
+		Allocator<T>& allocator = Allocator<T>::get_instance();
+		const int reserved_count = allocator.get_reserved_count();
+		const int block_count = (reserved_count + block_size - 1) / block_size;
+		for (int block = 0; block < block_count; block++)
+		{
+			CheckpointRecord record;
+			record.type = CheckpointRecordType::block_record;
+			record.allocator = allocator_id;
+			record.first_item = block * block_size;
+			record.item_count = std::min(block_size, reserved_count - record.first_item);
+
+			if (allocator.take_change(block) || record.first_item + record.item_count > saved_count)
+			{
+				const char* data = (const char*)allocator.get(record.first_item);
+				buffer.insert(buffer.end(), (const char*)&record, (const char*)(&record + 1));
+				buffer.insert(buffer.end(), data, data + record.item_count * sizeof(T));
+			}
+		}
+		saved_count = reserved_count;
+	}
+
+	// Takes the restored items as saved
+	void forget_changes()
+	{
+		Allocator<T>& allocator = Allocator<T>::get_instance();
+		const int reserved_count = allocator.get_reserved_count();
+		for (int block = 0; block * block_size < reserved_count; block++)
+		{
+			allocator.take_change(block);
+		}
+		saved_count = reserved_count;
+	}
+
+	void save_counters(int allocator_id, CheckpointCommit& commit) const
+	{
+		const Allocator<T>& allocator = Allocator<T>::get_instance();
+		commit.reserved_counts[allocator_id] = allocator.get_reserved_count();
+		commit.allocations_counts[allocator_id] = allocator.get_allocations_count();
+		commit.free_list_heads[allocator_id] = allocator.get_free_list_head();
+	}
+
+	void restore_counters(int allocator_id, const CheckpointCommit& commit) const
+	{
+		Allocator<T>& allocator = Allocator<T>::get_instance();
+		allocator.restore(commit.reserved_counts[allocator_id], commit.allocations_counts[allocator_id], commit.free_list_heads[allocator_id]);
+	}
+
+	// The counters must already be restored, so that the chunks holding the block exist
+	bool read_block(int fd, const CheckpointRecord& record) const
+	{
+		char* data = (char*)Allocator<T>::get_instance().get(record.first_item);
+		return read(fd, data, record.item_count * sizeof(T)) == (int)(record.item_count * sizeof(T));
+	}
+private:
+	int saved_count; // items below it were saved unless marked since
+};
+
+template <typename T>
+const int AllocatorSnapshot<T>::block_size;
+
+// Periodically saves a running construction to an append-only log, which a restarted process
+// can resume from. Each checkpoint holds the allocator blocks that changed since the previous one,
+// followed by a commit record with the allocator counters and the automaton's state. The nodes the
+// automaton changes are reported to on_change, so the automaton must be appended to with the
+// checkpointer as its observer. The log is written on a background thread; only the copying of
+// changed blocks stalls the caller.
+template <typename CharType>
+class Checkpointer : public DawgObserver
+{
+public:
+	Checkpointer(const char* const filename) : filename(filename), fd(-1), failed(false), input_hash(initial_input_hash), hashed_length(0)
+	{
+	}
+
+	~Checkpointer()
+	{
+		finish();
+		if (fd != -1)
+		{
+			close(fd);
+		}
+	}
+
+	// Restores the allocators from the last complete checkpoint of a build over the same input, with
+	// the same node layout. Returns false if there is none, in which case the log is started over.
+	bool resume(const char* const input, int input_length, CheckpointState& state)
+	{
+		fd = open_log(filename);
+		if (fd == -1)
+		{
+			failed = true;
+			return false;
+		}
+
+		CheckpointCommit commit = {};
+		long long commit_end = find_last_commit(commit);
+		if (commit_end == -1 || is_resumable(commit.state, input, input_length) == false)
+		{
+			truncate_log(fd, 0);
+			seek(fd, 0);
+			input_hash = initial_input_hash;
+			hashed_length = 0;
+			return false;
+		}
+
+		nodes.restore_counters(0, commit);
+		partial_lists.restore_counters(1, commit);
+		full_maps.restore_counters(2, commit);
+
+		seek(fd, 0);
+		long long position = 0;
+		CheckpointRecord record;
+		while (position < commit_end && read(fd, &record, sizeof(record)) == sizeof(record))
+		{
+			bool result = true;
+			if (record.type == CheckpointRecordType::block_record)
+			{
+				result = read_block(record);
+			}
+			else
+			{
+				CheckpointCommit skipped;
+				result = read(fd, &skipped, sizeof(skipped)) == sizeof(skipped);
+			}
+			if (result == false)
+			{
+				failed = true;
+				return false;
+			}
+			position = seek(fd, 0, SEEK_CUR);
+		}
+
+		truncate_log(fd, commit_end);
+		seek(fd, commit_end);
+
+		// The next checkpoint only carries the changes made after this one
+		nodes.forget_changes();
+		partial_lists.forget_changes();
+		full_maps.forget_changes();
+
+		state = commit.state;
+		return true;
+	}
+
+	// The input is hashed from where the previous checkpoint left off, so offsets must not decrease
+	void save(const Dawg<CharType>& dawg, const char* const input, int input_length, int input_offset)
+	{
+		if (writer.joinable())
+		{
+			writer.join();
+		}
+		if (fd == -1)
+		{
+			fd = open_log(filename);
+			truncate_log(fd, 0);
+			seek(fd, 0);
+		}
+
+		pending_blocks.clear();
+		nodes.collect(0, pending_blocks);
+		partial_lists.collect(1, pending_blocks);
+		full_maps.collect(2, pending_blocks);
+
+		pending_commit.type = CheckpointRecordType::commit_record;
+		pending_commit.allocator = -1;
+		pending_commit.first_item = 0;
+		pending_commit.item_count = 0;
+		hash_input(input, input_offset);
+		pending_state.state.input_hash = input_hash;
+		pending_state.state.input_length = input_length;
+		pending_state.state.input_offset = input_offset;
+		pending_state.state.source_node = dawg.get_source_node().to_int();
+		pending_state.state.active_node = dawg.get_active_node().to_int();
+		pending_state.state.node_size = sizeof(Node<CharType>);
+		pending_state.state.is_wide = is_wide;
+		nodes.save_counters(0, pending_state);
+		partial_lists.save_counters(1, pending_state);
+		full_maps.save_counters(2, pending_state);
+
+		writer = std::thread(&Checkpointer<CharType>::write_pending, this);
+	}
+
+	void on_change(AllocatorPtr<Node<CharType>> node)
+	{
+		Allocator<Node<CharType>>::get_instance().mark_changed(node.to_int());
+		node->mark_edges_changed();
+	}
+
+	// Waits for the last checkpoint to reach the disk. Returns false if any write failed.
+	bool finish()
+	{
+		if (writer.joinable())
+		{
+			writer.join();
+		}
+		return failed == false;
+	}
+private:
+	static const unsigned long long initial_input_hash = 14695981039346656037ULL;
+
+#ifdef WIDE_NODES
+	static const int is_wide = 1;
+#else
+	static const int is_wide = 0;
+#endif
+
+	// Leaves input_hash covering the first length letters
+	void hash_input(const char* const input, int length)
+	{
+		for (; hashed_length < length; hashed_length++)
+		{
+			input_hash = (input_hash ^ (unsigned char)input[hashed_length]) * 1099511628211ULL;
+		}
+	}
+
+	bool is_resumable(const CheckpointState& state, const char* const input, int input_length)
+	{
+		if (state.input_length != input_length || state.node_size != (int)sizeof(Node<CharType>) || state.is_wide != is_wide)
+		{
+			return false;
+		}
+		if (state.input_offset < 0 || state.input_offset > input_length)
+		{
+			return false;
+		}
+		hash_input(input, state.input_offset);
+		return input_hash == state.input_hash;
+	}
+
+	// The blocks are synced before the commit record, so a commit is never seen without its blocks
+	void write_pending()
+	{
+		bool result = fd != -1;
+		result = result && write_all(fd, pending_blocks.data(), pending_blocks.size());
+		result = result && sync_log(fd);
+		result = result && write_all(fd, (const char*)&pending_commit, sizeof(pending_commit));
+		result = result && write_all(fd, (const char*)&pending_state, sizeof(pending_state));
+		result = result && sync_log(fd);
+		if (result == false)
+		{
+			failed = true;
+		}
+	}
+
+	// Returns the offset just past the last complete commit record, or -1 if there is none
+	long long find_last_commit(CheckpointCommit& commit)
+	{
+		long long result = -1;
+		CheckpointRecord record;
+		while (read(fd, &record, sizeof(record)) == sizeof(record))
+		{
+			if (record.type == CheckpointRecordType::block_record && record.allocator >= 0 && record.allocator < 3)
+			{
+				seek(fd, (long long)record.item_count * item_size(record.allocator), SEEK_CUR);
+			}
+			else if (record.type == CheckpointRecordType::commit_record)
+			{
+				CheckpointCommit current;
+				if (read(fd, &current, sizeof(current)) != sizeof(current))
+				{
+					break;
+				}
+				commit = current;
+				result = seek(fd, 0, SEEK_CUR);
+			}
+			else
+			{
+				break;
+			}
+		}
+		return result;
+	}
+
+	bool read_block(const CheckpointRecord& record)
+	{
+		if (record.allocator == 0)
+		{
+			return nodes.read_block(fd, record);
+		}
+		else if (record.allocator == 1)
+		{
+			return partial_lists.read_block(fd, record);
+		}
+		else // (record.allocator == 2)
+		{
+			return full_maps.read_block(fd, record);
+		}
+	}
+
+	static int item_size(int allocator_id)
+	{
+		if (allocator_id == 0)
+		{
+			return sizeof(Node<CharType>);
+		}
+		else if (allocator_id == 1)
+		{
+			return sizeof(PartialEdgeList<CharType>);
+		}
+		else // (allocator_id == 2)
+		{
+			return sizeof(FullEdgeMap<CharType, 26>);
+		}
+	}
+
+	static bool write_all(int fd, const char* data, long long size)
+	{
+		while (size > 0)
+		{
+			const int written = write(fd, data, (unsigned int)std::min(size, 1LL << 30));
+			if (written <= 0)
+			{
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+#ifdef WIN32
+	static int open_log(const char* const filename)
+	{
+		return open(filename, O_RDWR | O_CREAT | O_BINARY, _S_IREAD | _S_IWRITE);
+	}
+
+	static long long seek(int fd, long long offset, int origin = SEEK_SET)
+	{
+		return _lseeki64(fd, offset, origin);
+	}
+
+	static bool truncate_log(int fd, long long size)
+	{
+		return _chsize_s(fd, size) == 0;
+	}
+
+	static bool sync_log(int fd)
+	{
+		return _commit(fd) == 0;
+	}
+#else
+	static int open_log(const char* const filename)
+	{
+		return open(filename, O_RDWR | O_CREAT, 0644);
+	}
+
+	static long long seek(int fd, long long offset, int origin = SEEK_SET)
+	{
+		return lseek(fd, offset, origin);
+	}
+
+	static bool truncate_log(int fd, long long size)
+	{
+		return ftruncate(fd, size) == 0;
+	}
+
+	static bool sync_log(int fd)
+	{
+		return fdatasync(fd) == 0;
+	}
+#endif
+
+	const char* const filename;
+	int fd;
+	bool failed;
+	AllocatorSnapshot<Node<CharType>> nodes;
+	AllocatorSnapshot<PartialEdgeList<CharType>> partial_lists;
+	AllocatorSnapshot<FullEdgeMap<CharType, 26>> full_maps;
+	std::vector<char> pending_blocks;
+	CheckpointRecord pending_commit;
+	CheckpointCommit pending_state;
+	unsigned long long input_hash;
+	int hashed_length;
+	std::thread writer;
+};
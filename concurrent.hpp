@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+
+// An automaton that one thread appends to while any number of readers query it, without locks.
+//
+// The writer publishes every change to a node with a single store (see publish in nodes.hpp),
+// after whatever the change makes reachable, so readers always find complete nodes and
+// containers. Edge lists the writer frees may still be in use by readers; they are only reused
+// once every reader has left the epoch in which they were freed. Each node records where the
+// first occurrence of its strings ends, and a query only counts strings whose first occurrence
+// ends within the text length published when the query began. Every answer is thereby exact for
+// one prefix of the text, while the writer is never blocked.
+template <typename CharType>
+class ConcurrentDawg : public DawgObserver
+{
+public:
+	static const int max_readers = 64;
+
+	// Holds a reader slot; a thread keeps one for as long as it queries the automaton
+	class Reader
+	{
+	public:
+		Reader(ConcurrentDawg<CharType>& dawg) : dawg(dawg), slot(dawg.claim_reader_slot()), snapshot_length(0)
+		{
+		}
+
+		~Reader()
+		{
+			dawg.reader_slots[slot].is_claimed.store(false);
+		}
+
+		// Answers for the text as it was when the query began, get_snapshot_length() letters long
+		bool contains(const CharType* letters, int length)
+		{
+			enter();
+			const int text_length = dawg.length.load(std::memory_order_acquire);
+			snapshot_length = text_length;
+			AllocatorPtr<Node<CharType>> node = dawg.dawg.get_source_node();
+			bool result = true;
+			for (int i = 0; i < length && result; i++)
+			{
+				const Edge<CharType> edge = node->get_published_edge(letters[i]);
+				result = edge.is_present();
+				if (result)
+				{
+					node = edge.get_exit_node();
+				}
+			}
+			result = result && dawg.get_first_end(node) < text_length;
+			leave();
+			return result;
+		}
+
+		int get_snapshot_length() const
+		{
+			return snapshot_length;
+		}
+	private:
+		// The slot is checked against the epoch again, so the writer cannot have moved past it unseen
+		void enter()
+		{
+			std::atomic<unsigned long long>& reader_epoch = dawg.reader_slots[slot].epoch;
+			unsigned long long epoch;
+			do
+			{
+				epoch = dawg.epoch.load();
+				reader_epoch.store(epoch);
+			} while (dawg.epoch.load() != epoch);
+		}
+
+		void leave()
+		{
+			dawg.reader_slots[slot].epoch.store(0, std::memory_order_release);
+		}
+
+		ConcurrentDawg<CharType>& dawg;
+		const int slot;
+		int snapshot_length;
+	};
+
+	ConcurrentDawg() : length(0), epoch(1)
+	{
+		Allocator<PartialEdgeList<CharType>>::get_instance().set_deferring_frees(true);
+		for (int i = 0; i < max_chunks; i++)
+		{
+			first_end_chunks[i].store(0);
+		}
+		set_first_end(dawg.get_source_node(), -1);
+	}
+
+	// All readers must be gone
+	~ConcurrentDawg()
+	{
+		Allocator<PartialEdgeList<CharType>>& allocator = Allocator<PartialEdgeList<CharType>>::get_instance();
+		allocator.release_deferred_frees(retired[0]);
+		allocator.release_deferred_frees(retired[1]);
+		allocator.release_deferred_frees(allocator.take_deferred_frees());
+		allocator.set_deferring_frees(false);
+		dawg.free();
+		for (int i = 0; i < max_chunks; i++)
+		{
+			delete[] first_end_chunks[i].load();
+		}
+	}
+
+	void append(CharType letter)
+	{
+		const int position = length.load(std::memory_order_relaxed);
+		dawg.append(letter, *this);
+		set_first_end(dawg.get_active_node(), position);
+		length.store(position + 1, std::memory_order_release);
+		if ((position & 4095) == 0)
+		{
+			try_advance_epoch();
+		}
+	}
+
+	int get_length() const
+	{
+		return length.load(std::memory_order_acquire);
+	}
+
+	// The clone's strings first occur where those of the node it was split from do
+	void on_split(AllocatorPtr<Node<CharType>> child_node, AllocatorPtr<Node<CharType>> new_child_node)
+	{
+		set_first_end(new_child_node, get_first_end(child_node));
+	}
+private:
+	static const int chunk_size = 1 << 23;
+	static const int max_chunks = 64;
+
+	struct alignas(64) ReaderSlot
+	{
+		std::atomic<bool> is_claimed;
+		std::atomic<unsigned long long> epoch; // 0 while outside a query
+	};
+
+	int claim_reader_slot()
+	{
+		for (int i = 0; ; i = (i + 1) % max_readers)
+		{
+			bool expected = false;
+			if (reader_slots[i].is_claimed.compare_exchange_weak(expected, true))
+			{
+				return i;
+			}
+		}
+	}
+
+	// Once every reader inside a query is in the current epoch, nobody can still hold the lists freed
+	// in the previous one. The lists freed in this epoch wait for the next advance.
+	void try_advance_epoch()
+	{
+		const unsigned long long current_epoch = epoch.load();
+		for (int i = 0; i < max_readers; i++)
+		{
+			const unsigned long long reader_epoch = reader_slots[i].epoch.load();
+			if (reader_epoch != 0 && reader_epoch != current_epoch)
+			{
+				return;
+			}
+		}
+
+		Allocator<PartialEdgeList<CharType>>& allocator = Allocator<PartialEdgeList<CharType>>::get_instance();
+		allocator.release_deferred_frees(retired[(current_epoch + 1) % 2]);
+		retired[(current_epoch + 1) % 2].clear();
+		retired[current_epoch % 2] = allocator.take_deferred_frees();
+		epoch.store(current_epoch + 1);
+	}
+
+	// Chunks are never moved, so readers can look up while the writer adds more; INT_MAX stands for
+	// a node whose position is not set yet, which can only be a node of the letter being appended
+	void set_first_end(AllocatorPtr<Node<CharType>> node, int position)
+	{
+		const int index = node.to_int();
+		int* chunk = first_end_chunks[index / chunk_size].load(std::memory_order_relaxed);
+		if (chunk == 0)
+		{
+			chunk = new int[chunk_size];
+			std::fill(chunk, chunk + chunk_size, INT_MAX);
+			first_end_chunks[index / chunk_size].store(chunk, std::memory_order_release);
+		}
+		publish(chunk[index % chunk_size], position);
+	}
+
+	int get_first_end(AllocatorPtr<Node<CharType>> node) const
+	{
+		const int index = node.to_int();
+		const int* chunk = first_end_chunks[index / chunk_size].load(std::memory_order_acquire);
+		return chunk ? load_published(chunk[index % chunk_size]) : INT_MAX;
+	}
+
+	Dawg<CharType> dawg;
+	std::atomic<int> length;
+	std::atomic<unsigned long long> epoch;
+	ReaderSlot reader_slots[max_readers];
+	std::vector<int> retired[2];
+	std::atomic<int*> first_end_chunks[max_chunks];
+};
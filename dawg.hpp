@@ -1,21 +1,136 @@
 #pragma once
 
+#include <vector>
+
 #include "memory.hpp"
 #include "nodes.hpp"
 
+// Receives notifications from Dawg::append. Observers derive from this and hide the hooks they need.
+class DawgObserver
+{
+public:
+	// A new node was cloned off child_node to hold its shorter strings; nothing leads to it yet
+	template <typename CharType>
+	void on_split(AllocatorPtr<Node<CharType>> /* child_node */, AllocatorPtr<Node<CharType>> /* new_child_node */)
+	{
+	}
+
+	// The longest context that had been followed by the letter is the node, and its primary edge leads
+	// to target_node
+	template <typename CharType>
+	void on_predict(AllocatorPtr<Node<CharType>> /* node */, AllocatorPtr<Node<CharType>> /* target_node */)
+	{
+	}
+
+	// The suffix link or the edges of a node that existed before the letter was appended changed
+	template <typename CharType>
+	void on_change(AllocatorPtr<Node<CharType>> /* node */)
+	{
+	}
+};
+
 template <typename CharType>
 class Dawg
 {
 public:
-	Dawg(const char* const word) : source_ptr(Node<CharType>::create())
+	Dawg() : source_ptr(Node<CharType>::create()), active_node_ptr(source_ptr), is_active_node_shared(false), node_count(1)
+	{
+		source_ptr->set_suffix(0);
+		begin_history();
+	}
+
+	// Continues an automaton whose nodes are already in the allocators, e.g. after a restart
+	Dawg(AllocatorPtr<Node<CharType>> source_node, AllocatorPtr<Node<CharType>> active_node)
+		: source_ptr(source_node), active_node_ptr(active_node), is_active_node_shared(false), node_count(-1), is_keeping_history(false), border_length(-1)
+	{
+	}
+
+	Dawg(const char* const word) : source_ptr(Node<CharType>::create()), active_node_ptr(source_ptr), is_active_node_shared(false), node_count(1)
 	{
 		Node<CharType>& source = *source_ptr;
 		source.set_suffix(0);
-		AllocatorPtr<Node<CharType>> active_node = source_ptr;
+		begin_history();
 		for (int i = 0; word[i]; i++)
 		{
-			CharType letter = 0x1f & word[i]; // TODO: a nicer solution to this
-			active_node = update(active_node, letter);
+			append(to_letter(word[i]));
+		}
+	}
+
+	static CharType to_letter(char c)
+	{
+		return 0x1f & c; // TODO: a nicer solution to this
+	}
+
+	void append(CharType letter)
+	{
+		DawgObserver observer;
+		append(letter, observer);
+	}
+
+	template <typename Observer>
+	void append(CharType letter, Observer& observer)
+	{
+		if (is_active_node_shared)
+		{
+			active_node_ptr = extend_shared(active_node_ptr, letter, observer);
+		}
+		else if (border_length >= 0 && history_letters[border_length % history_size] == letter)
+		{
+			active_node_ptr = extend_border(letter, observer);
+		}
+		else
+		{
+			active_node_ptr = update(active_node_ptr, letter, observer);
+			border_length = is_keeping_history && active_node_ptr->get_suffix() == source_ptr ? 0 : -1;
+		}
+
+		if (is_keeping_history)
+		{
+			record_history(letter);
+		}
+	}
+
+	// Starts another string; the automaton then holds the substrings of all of them
+	void begin_segment()
+	{
+		active_node_ptr = source_ptr;
+		is_active_node_shared = true;
+		is_keeping_history = false;
+		border_length = -1;
+	}
+
+	bool contains(const CharType* letters, int length) const
+	{
+		AllocatorPtr<Node<CharType>> current_node_ptr = source_ptr;
+		for (int i = 0; i < length; i++)
+		{
+			const Edge<CharType> edge = current_node_ptr->get_outgoing_edge(letters[i]);
+			if (edge.is_present() == false)
+			{
+				return false;
+			}
+			current_node_ptr = edge.get_exit_node();
+		}
+		return true;
+	}
+
+	// Every node other than the source has exactly one incoming primary edge, so walking
+	// the primary edges releases each node exactly once. The automaton is unusable afterwards.
+	void free()
+	{
+		std::vector<AllocatorPtr<Node<CharType>>> pending(1, source_ptr);
+		while (pending.empty() == false)
+		{
+			const AllocatorPtr<Node<CharType>> node_ptr = pending.back();
+			pending.pop_back();
+			node_ptr->for_each_edge([&pending](const LabeledEdge<CharType> edge)
+			{
+				if (edge.edge.get_type() == EdgeType::primary)
+				{
+					pending.push_back(edge.edge.get_exit_node());
+				}
+			});
+			Node<CharType>::destroy(node_ptr);
 		}
 	}
 
@@ -23,12 +138,100 @@ public:
 	{
 		return *source_ptr;
 	}
+
+	AllocatorPtr<Node<CharType>> get_source_node() const
+	{
+		return source_ptr;
+	}
+
+	AllocatorPtr<Node<CharType>> get_active_node() const
+	{
+		return active_node_ptr;
+	}
+
+	// Including the source, or -1 if the automaton was continued from nodes already in the allocators
+	int get_node_count() const
+	{
+		return node_count;
+	}
 private:
-	AllocatorPtr<Node<CharType>> update(AllocatorPtr<Node<CharType>> active_node_ptr, CharType letter)
+	static const int history_size = 4096;
+
+	// The fast path of periodic text needs the last history_size letters and prefix nodes. Only
+	// automata of a single string built from the start keep them, and the history grows with the
+	// text, so that short-lived automata (see sliding-window.hpp) only pay for what they append.
+	void begin_history()
+	{
+		is_keeping_history = true;
+		history_length = 0;
+		border_length = -1;
+	}
+
+	// A border can only start at a letter that is new to the text, and the fast path is only taken
+	// while the period is shorter than history_size. Once the text is longer than that without a
+	// border, no border can start that the history would still cover, and the history is dropped.
+	void record_history(CharType letter)
+	{
+		if (history_length >= history_size && border_length == -1)
+		{
+			is_keeping_history = false;
+			std::vector<CharType>().swap(history_letters);
+			std::vector<AllocatorPtr<Node<CharType>>>().swap(history_nodes);
+			return;
+		}
+		if (history_length == 0)
+		{
+			history_nodes.push_back(source_ptr);
+		}
+		record(history_letters, history_length, letter);
+		++history_length;
+		record(history_nodes, history_length, active_node_ptr);
+		if (history_length - border_length >= history_size)
+		{
+			border_length = -1;
+		}
+	}
+
+	// Positions come in order, so the first history_size of them are appended
+	template <typename T>
+	static void record(std::vector<T>& history, int position, T value)
+	{
+		if (position < history_size)
+		{
+			history.push_back(value);
+		}
+		else
+		{
+			history[position % history_size] = value;
+		}
+	}
+
+	// The active node's suffix is the node of a prefix of the text, the prefix of border_length
+	// letters, and the letter continues that prefix: the text is periodic with period
+	// history_length - border_length so far. The suffix walk of update would end right away, at the
+	// prefix's primary edge, so the new suffix is the next prefix node, which the history holds.
+	// Text that only turns periodic after its start has its longest repeated suffix somewhere else,
+	// and update splits a node for it at every letter, which this does not save.
+	template <typename Observer>
+	AllocatorPtr<Node<CharType>> extend_border(CharType letter, Observer& observer)
 	{
-		const AllocatorPtr<Node<CharType>> new_active_node = Node<CharType>::create();
+		const AllocatorPtr<Node<CharType>> new_active_node = create_node();
+		active_node_ptr->add_edge(letter, new_active_node, EdgeType::primary);
+		observer.on_change(active_node_ptr);
+		const AllocatorPtr<Node<CharType>> suffix_node = history_nodes[(border_length + 1) % history_size];
+		observer.on_predict(history_nodes[border_length % history_size], suffix_node);
+		new_active_node->set_suffix(suffix_node);
+		++border_length;
+		return new_active_node;
+	}
+
+	template <typename Observer>
+	AllocatorPtr<Node<CharType>> update(AllocatorPtr<Node<CharType>> active_node_ptr, CharType letter, Observer& observer)
+	{
+		const AllocatorPtr<Node<CharType>> new_active_node = create_node();
 		Node<CharType>& active_node = *active_node_ptr;
 		active_node.add_edge(letter, new_active_node, EdgeType::primary);
+		observer.on_change(active_node_ptr);
 		AllocatorPtr<Node<CharType>> current_node_ptr = active_node_ptr;
 		AllocatorPtr<Node<CharType>> suffix_node = 0;
 
@@ -40,6 +243,7 @@ private:
 			if (outgoing_edge.is_present() == false)
 			{
 				current_node.add_edge(letter, new_active_node, EdgeType::secondary);
+				observer.on_change(current_node_ptr);
 			}
 			else if (outgoing_edge.get_type() == EdgeType::primary)
 			{
@@ -47,31 +251,66 @@ private:
 			}
 			else // (outgoing_edge.get_type() == EdgeType::secondary)
 			{
-				suffix_node = split(current_node_ptr, letter);
+				suffix_node = split(current_node_ptr, letter, outgoing_edge.get_exit_node(), observer);
 			}
 		}
 		if (suffix_node == 0)
 		{
 			suffix_node = source_ptr;
 		}
+		else
+		{
+			observer.on_predict(current_node_ptr, suffix_node);
+		}
 		new_active_node->set_suffix(suffix_node);
 		return new_active_node;
 	}
 
-	AllocatorPtr<Node<CharType>> split(AllocatorPtr<Node<CharType>> parent_node_ptr, CharType label)
+	// While the current segment only repeats earlier text, the active node is an existing node and
+	// may already have the letter's edge. A primary edge leads to the node of the longer strings;
+	// a secondary one joins a node of longer strings, which has to be split first.
+	template <typename Observer>
+	AllocatorPtr<Node<CharType>> extend_shared(AllocatorPtr<Node<CharType>> active_node_ptr, CharType letter, Observer& observer)
 	{
-		const AllocatorPtr<Node<CharType>> new_child_node_ptr = Node<CharType>::create();
+		const Edge<CharType> outgoing_edge = active_node_ptr->get_outgoing_edge(letter);
+		if (outgoing_edge.is_present() == false)
+		{
+			is_active_node_shared = false;
+			return update(active_node_ptr, letter, observer);
+		}
+		const AllocatorPtr<Node<CharType>> target_node = outgoing_edge.get_type() == EdgeType::primary
+			? outgoing_edge.get_exit_node() : split(active_node_ptr, letter, outgoing_edge.get_exit_node(), observer);
+		observer.on_predict(active_node_ptr, target_node);
+		return target_node;
+	}
+
+	AllocatorPtr<Node<CharType>> create_node()
+	{
+		if (node_count != -1)
+		{
+			++node_count;
+		}
+		return Node<CharType>::create();
+	}
+
+	// The parent's secondary edge labeled label leads to child_node_ptr
+	template <typename Observer>
+	AllocatorPtr<Node<CharType>> split(AllocatorPtr<Node<CharType>> parent_node_ptr, CharType label, AllocatorPtr<Node<CharType>> child_node_ptr, Observer& observer)
+	{
+		const AllocatorPtr<Node<CharType>> new_child_node_ptr = create_node();
 		Node<CharType>& new_child_node = *new_child_node_ptr;
 		Node<CharType>& parent_node = *parent_node_ptr;
-		const Edge<CharType> outgoing_edge = parent_node.get_outgoing_edge(label);
-		const AllocatorPtr<Node<CharType>> child_node_ptr = outgoing_edge.get_exit_node();
 		Node<CharType>& child_node = *child_node_ptr;
 
-		assert(outgoing_edge.get_type() == EdgeType::secondary);
-		parent_node.set_outgoing_edge_props(label, EdgeType::primary, new_child_node_ptr);
+		// The clone is complete before the parent's edge makes it reachable (see concurrent.hpp)
+		assert(parent_node.get_outgoing_edge(label).get_type() == EdgeType::secondary);
 		new_child_node.add_secondary_edges(child_node);
 		new_child_node.set_suffix(child_node.get_suffix());
+		observer.on_split(child_node_ptr, new_child_node_ptr);
+		parent_node.set_outgoing_edge_props(label, EdgeType::primary, new_child_node_ptr);
+		observer.on_change(parent_node_ptr);
 		child_node.set_suffix(new_child_node_ptr);
+		observer.on_change(child_node_ptr);
 
 		AllocatorPtr<Node<CharType>> current_node_ptr = parent_node_ptr;
 		while (current_node_ptr != source_ptr)
@@ -83,6 +322,7 @@ private:
 			{
 				assert(edge.get_type() == EdgeType::secondary);
 				current_node.set_outgoing_edge_props(label, EdgeType::secondary, new_child_node_ptr);
+				observer.on_change(current_node_ptr);
 			}
 			else
 			{
@@ -93,4 +333,12 @@ private:
 	}
 
 	const AllocatorPtr<Node<CharType>> source_ptr;
+	AllocatorPtr<Node<CharType>> active_node_ptr;
+	bool is_active_node_shared;
+	int node_count;
+	bool is_keeping_history;
+	int history_length;
+	int border_length; // of the prefix whose node is the active node's suffix, or -1 if not known
+	std::vector<CharType> history_letters; // the letter at each position, modulo history_size
+	std::vector<AllocatorPtr<Node<CharType>>> history_nodes; // the node of each prefix, by length modulo history_size
 };
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+
+// The minimal acyclic automaton of a word list, built incrementally from words in sorted order
+// (Daciuk, Mihov, Watson, Watson, 2000). Only the path of the last word is ever modified;
+// every node off that path is minimal and kept in a register of unique nodes. When the next word
+// branches off, the abandoned part of the path is minimized bottom-up: nodes with an equivalent
+// in the register are freed and replaced by it, the others are registered.
+// The memory therefore stays proportional to the minimal automaton, not to the word list.
+template <typename CharType>
+class Dictionary
+{
+public:
+	Dictionary() : node_count(1), word_count(0), register_count(0)
+	{
+		path.push_back(Node<CharType>::create());
+		register_slots.resize(1024, 0);
+	}
+
+	static CharType to_letter(char c)
+	{
+		return 0x1f & c;
+	}
+
+	static char to_char(CharType letter)
+	{
+		return 0x60 | letter;
+	}
+
+	// Only the letters a to z are supported. Upper case would fold onto them, so that a byte-sorted
+	// list would no longer be in letter order; other characters fall outside the alphabet of the nodes.
+	static bool is_letter(char c)
+	{
+		return c >= 'a' && c <= 'z';
+	}
+
+	static bool is_word(const char* const word, int length)
+	{
+		for (int i = 0; i < length; i++)
+		{
+			if (is_letter(word[i]) == false)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Returns false (and ignores the word) if it comes before the previous one.
+	// The word must pass is_word.
+	bool add_word(const char* const word, int length)
+	{
+		int common_prefix = 0;
+		while (common_prefix < length && common_prefix < (int)previous_word.size() && to_letter(word[common_prefix]) == previous_word[common_prefix])
+		{
+			++common_prefix;
+		}
+		if (common_prefix < (int)previous_word.size() && (common_prefix == length || to_letter(word[common_prefix]) < previous_word[common_prefix]))
+		{
+			return false;
+		}
+
+		minimize(common_prefix);
+		previous_word.resize(common_prefix);
+		for (int i = common_prefix; i < length; i++)
+		{
+			const CharType letter = to_letter(word[i]);
+			const AllocatorPtr<Node<CharType>> node = Node<CharType>::create();
+			++node_count;
+			path.back()->add_edge(letter, node, EdgeType::primary);
+			path.push_back(node);
+			previous_word.push_back(letter);
+		}
+		if (path.back()->is_final() == false)
+		{
+			path.back()->set_final(true);
+			++word_count;
+		}
+		return true;
+	}
+
+	// Minimizes the path of the last word and drops the register; no words can be added afterwards
+	void finish()
+	{
+		minimize(0);
+		previous_word.clear();
+		std::vector<int>().swap(register_slots);
+		register_count = 0;
+	}
+
+	bool contains(const char* const word) const
+	{
+		AllocatorPtr<Node<CharType>> node = follow(word);
+		return node.not_null() && node->is_final();
+	}
+
+	// Calls function(word) for every word starting with the prefix, in sorted order
+	template <typename Function>
+	void for_each_word(const char* const prefix, Function function) const
+	{
+		AllocatorPtr<Node<CharType>> node = follow(prefix);
+		if (node.not_null())
+		{
+			std::string word;
+			for (int i = 0; prefix[i]; i++)
+			{
+				word.push_back(to_char(to_letter(prefix[i])));
+			}
+			enumerate(node, word, function);
+		}
+	}
+
+	int get_node_count() const
+	{
+		return node_count;
+	}
+
+	int get_word_count() const
+	{
+		return word_count;
+	}
+private:
+	AllocatorPtr<Node<CharType>> follow(const char* const word) const
+	{
+		AllocatorPtr<Node<CharType>> node = path.front();
+		for (int i = 0; word[i]; i++)
+		{
+			if (is_letter(word[i]) == false)
+			{
+				return 0;
+			}
+			const Edge<CharType> edge = node->get_outgoing_edge(to_letter(word[i]));
+			if (edge.is_present() == false)
+			{
+				return 0;
+			}
+			node = edge.get_exit_node();
+		}
+		return node;
+	}
+
+	template <typename Function>
+	void enumerate(AllocatorPtr<Node<CharType>> node, std::string& word, Function& function) const
+	{
+		if (node->is_final())
+		{
+			function(word);
+		}
+		node->for_each_edge([this, &word, &function](const LabeledEdge<CharType> edge)
+		{
+			word.push_back(to_char(edge.label));
+			enumerate(edge.edge.get_exit_node(), word, function);
+			word.pop_back();
+		});
+	}
+
+	// Replaces the nodes of the last word's path deeper than depth with their registered equivalents
+	void minimize(int depth)
+	{
+		for (int i = (int)path.size() - 1; i > depth; i--)
+		{
+			const AllocatorPtr<Node<CharType>> node = path[i];
+			const AllocatorPtr<Node<CharType>> registered = find_or_register(node);
+			if (registered != node)
+			{
+				path[i - 1]->set_outgoing_edge_props(previous_word[i - 1], EdgeType::primary, registered);
+				Node<CharType>::destroy(node);
+				--node_count;
+			}
+		}
+		path.erase(path.begin() + depth + 1, path.end());
+	}
+
+	// The register is an open addressing hash set of node indices; 0 marks an empty slot
+	AllocatorPtr<Node<CharType>> find_or_register(AllocatorPtr<Node<CharType>> node)
+	{
+		if (2 * (register_count + 1) > (int)register_slots.size())
+		{
+			grow_register();
+		}
+		const int mask = register_slots.size() - 1;
+		for (int slot = hash(node) & mask; ; slot = (slot + 1) & mask)
+		{
+			if (register_slots[slot] == 0)
+			{
+				register_slots[slot] = node.to_int();
+				++register_count;
+				return node;
+			}
+			if (are_equivalent(register_slots[slot], node))
+			{
+				return register_slots[slot];
+			}
+		}
+	}
+
+	void grow_register()
+	{
+		std::vector<int> old_slots(2 * register_slots.size(), 0);
+		old_slots.swap(register_slots);
+		const int mask = register_slots.size() - 1;
+		for (const int node : old_slots)
+		{
+			if (node)
+			{
+				int slot = hash(node) & mask;
+				while (register_slots[slot])
+				{
+					slot = (slot + 1) & mask;
+				}
+				register_slots[slot] = node;
+			}
+		}
+	}
+
+	static unsigned int hash(AllocatorPtr<Node<CharType>> node)
+	{
+		unsigned long long result = node->is_final();
+		node->for_each_edge([&result](const LabeledEdge<CharType> edge)
+		{
+			unsigned long long edge_hash = ((unsigned long long)edge.label << 32 | edge.edge.get_exit_node().to_int()) * 0x9e3779b97f4a7c15ULL;
+			result += edge_hash ^ (edge_hash >> 29);
+		});
+		return (unsigned int)(result ^ (result >> 32));
+	}
+
+	// The nodes' children are all registered already, so equivalent nodes have identical edges
+	static bool are_equivalent(AllocatorPtr<Node<CharType>> first, AllocatorPtr<Node<CharType>> second)
+	{
+		if (first->is_final() != second->is_final() || first->get_edge_count() != second->get_edge_count())
+		{
+			return false;
+		}
+		bool result = true;
+		first->for_each_edge([&result, second](const LabeledEdge<CharType> edge)
+		{
+			const Edge<CharType> other_edge = second->get_outgoing_edge(edge.label);
+			result = result && other_edge.is_present() && other_edge.get_exit_node() == edge.edge.get_exit_node();
+		});
+		return result;
+	}
+
+	// path[i] is the node reached by the first i letters of the previous word
+	std::vector<AllocatorPtr<Node<CharType>>> path;
+	std::vector<CharType> previous_word;
+	std::vector<int> register_slots;
+	int node_count;
+	int word_count;
+	int register_count;
+};
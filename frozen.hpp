@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+#include "parallel.hpp"
+
+// A flat copy of an automaton. When the allocator holds no other nodes, its nodes are numbered in
+// allocator order, leaving out the free slots; otherwise in breadth-first order of the primary
+// edges, which reach each node of the automaton once. Either way the source is node 0. The edges of
+// node i are stored sorted by label in labels/targets[edge_offsets[i] .. edge_offsets[i + 1]). The
+// source has suffix -1.
+//
+// Every pass works on disjoint node ranges in parallel: edge counts are summed per range,
+// a prefix sum over the ranges gives each one its output offset, and each range then fills
+// in (and writes out) its own part of the arrays.
+template <typename CharType>
+class FrozenDawg
+{
+public:
+	FrozenDawg() : node_count(0), edge_count(0), range_count(0)
+	{
+	}
+
+	void freeze(const Dawg<CharType>& dawg, int thread_count)
+	{
+		range_count = thread_count;
+		if (number_in_allocator_order(dawg) == false)
+		{
+			number_in_breadth_first_order(dawg);
+		}
+		node_count = order.size();
+		range_edge_offsets.assign(range_count + 1, 0);
+		edge_offsets.reset(new int[node_count + 1]);
+		suffixes.reset(new int[node_count]);
+
+		parallel_for(0, node_count, range_count, [this](int range, int begin, int end)
+		{
+			int range_edge_count = 0;
+			for (int i = begin; i < end; ++i)
+			{
+				const AllocatorPtr<Node<CharType>> node = order[i];
+				range_edge_count += node->get_edge_count();
+				suffixes[i] = numbers[node->get_suffix().to_int()];
+			}
+			range_edge_offsets[range + 1] = range_edge_count;
+		});
+
+		for (int range = 0; range < range_count; range++)
+		{
+			range_edge_offsets[range + 1] += range_edge_offsets[range];
+		}
+		edge_count = range_edge_offsets[range_count];
+		edge_offsets[node_count] = edge_count;
+		labels.reset(new CharType[edge_count]);
+		targets.reset(new int[edge_count]);
+
+		parallel_for(0, node_count, range_count, [this](int range, int begin, int end)
+		{
+			int offset = range_edge_offsets[range];
+			for (int i = begin; i < end; ++i)
+			{
+				edge_offsets[i] = offset;
+				const int first = offset;
+				AllocatorPtr<Node<CharType>>(order[i])->for_each_edge([this, &offset, first](const LabeledEdge<CharType> edge)
+				{
+					int position = offset++;
+					for (; position > first && labels[position - 1] > edge.label; position--)
+					{
+						labels[position] = labels[position - 1];
+						targets[position] = targets[position - 1];
+					}
+					labels[position] = edge.label;
+					targets[position] = numbers[edge.edge.get_exit_node().to_int()];
+				});
+			}
+		});
+		std::vector<int>().swap(order);
+		std::vector<int>().swap(numbers);
+	}
+
+	// Layout: node count, edge count, edge offsets, suffixes, labels, targets
+	bool write(const char* const filename) const
+	{
+		int fd = open_for_writing(filename);
+		if (fd == -1)
+		{
+			return false;
+		}
+
+		const int counts[2] = { node_count, edge_count };
+		const long long edge_offsets_position = sizeof(counts);
+		const long long suffixes_position = edge_offsets_position + (node_count + 1) * sizeof(int);
+		const long long labels_position = suffixes_position + node_count * sizeof(int);
+		const long long targets_position = labels_position + edge_count * sizeof(CharType);
+
+		bool result = write_at(fd, counts, sizeof(counts), 0);
+		result &= write_at(fd, &edge_offsets[node_count], sizeof(int), edge_offsets_position + node_count * sizeof(int));
+		parallel_for(0, node_count, range_count, [&](int range, int begin, int end)
+		{
+			const int first_edge = range_edge_offsets[range];
+			const int last_edge = range_edge_offsets[range + 1];
+			bool range_result = write_at(fd, &edge_offsets[begin], (end - begin) * sizeof(int), edge_offsets_position + begin * sizeof(int));
+			range_result &= write_at(fd, &suffixes[begin], (end - begin) * sizeof(int), suffixes_position + begin * sizeof(int));
+			range_result &= write_at(fd, &labels[first_edge], (last_edge - first_edge) * sizeof(CharType), labels_position + first_edge * sizeof(CharType));
+			range_result &= write_at(fd, &targets[first_edge], (last_edge - first_edge) * sizeof(int), targets_position + first_edge * sizeof(int));
+			if (range_result == false)
+			{
+				std::lock_guard<std::mutex> lock(write_mutex);
+				result = false;
+			}
+		});
+
+		result &= close(fd) == 0;
+		return result;
+	}
+
+	int get_node_count() const
+	{
+		return node_count;
+	}
+
+	int get_edge_count() const
+	{
+		return edge_count;
+	}
+private:
+	// numbers maps allocator indices to node numbers; index 0, the source's null suffix, maps to -1.
+	// Each range counts its slots that are not free, and a prefix sum over the ranges gives the number
+	// of its first node. Fails if the slots hold nodes of other automata, or the source is not first.
+	bool number_in_allocator_order(const Dawg<CharType>& dawg)
+	{
+		const Allocator<Node<CharType>>& allocator = Allocator<Node<CharType>>::get_instance();
+		const int reserved_count = allocator.get_reserved_count();
+		numbers.assign(reserved_count, 0);
+		numbers[0] = -1;
+		allocator.for_each_free([this](int index)
+		{
+			numbers[index] = -1;
+		});
+
+		std::vector<int> range_node_offsets(range_count + 1, 0);
+		parallel_for(1, reserved_count, range_count, [this, &range_node_offsets](int range, int begin, int end)
+		{
+			int range_node_count = 0;
+			for (int i = begin; i < end; ++i)
+			{
+				range_node_count += numbers[i] == 0;
+			}
+			range_node_offsets[range + 1] = range_node_count;
+		});
+		for (int range = 0; range < range_count; range++)
+		{
+			range_node_offsets[range + 1] += range_node_offsets[range];
+		}
+		if (range_node_offsets[range_count] != dawg.get_node_count() || dawg.get_source_node().to_int() != first_live_slot())
+		{
+			return false;
+		}
+
+		order.resize(range_node_offsets[range_count]);
+		parallel_for(1, reserved_count, range_count, [this, &range_node_offsets](int range, int begin, int end)
+		{
+			int number = range_node_offsets[range];
+			for (int i = begin; i < end; ++i)
+			{
+				if (numbers[i] == 0)
+				{
+					order[number] = i;
+					numbers[i] = number++;
+				}
+			}
+		});
+		return true;
+	}
+
+	int first_live_slot() const
+	{
+		int result = 1;
+		while (result < (int)numbers.size() && numbers[result] != 0)
+		{
+			++result;
+		}
+		return result;
+	}
+
+	void number_in_breadth_first_order(const Dawg<CharType>& dawg)
+	{
+		numbers.assign(Allocator<Node<CharType>>::get_instance().get_reserved_count(), -1);
+		order.assign(1, dawg.get_source_node().to_int());
+		numbers[order[0]] = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			AllocatorPtr<Node<CharType>>(order[i])->for_each_edge([this](const LabeledEdge<CharType> edge)
+			{
+				if (edge.edge.get_type() == EdgeType::primary)
+				{
+					numbers[edge.edge.get_exit_node().to_int()] = order.size();
+					order.push_back(edge.edge.get_exit_node().to_int());
+				}
+			});
+		}
+	}
+
+#ifdef WIN32
+	static int open_for_writing(const char* const filename)
+	{
+		return open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, _S_IREAD | _S_IWRITE);
+	}
+
+	bool write_at(int fd, const void* data, long long size, long long position) const
+	{
+		std::lock_guard<std::mutex> lock(write_mutex);
+		return _lseeki64(fd, position, SEEK_SET) == position && _write(fd, data, (unsigned int)size) == size;
+	}
+#else
+	static int open_for_writing(const char* const filename)
+	{
+		return open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	bool write_at(int fd, const void* data, long long size, long long position) const
+	{
+		const char* bytes = (const char*)data;
+		while (size > 0)
+		{
+			const ssize_t written = pwrite(fd, bytes, size, position);
+			if (written <= 0)
+			{
+				return false;
+			}
+			bytes += written;
+			size -= written;
+			position += written;
+		}
+		return true;
+	}
+#endif
+
+	int node_count;
+	int edge_count;
+	int range_count;
+	std::vector<int> order; // the allocator index of each node, while freezing
+	std::vector<int> numbers;
+	std::vector<int> range_edge_offsets;
+	std::unique_ptr<int[]> edge_offsets;
+	std::unique_ptr<int[]> suffixes;
+	std::unique_ptr<CharType[]> labels;
+	std::unique_ptr<int[]> targets;
+	mutable std::mutex write_mutex;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+
+// Bits 1 and 2 of the ASCII code tell the four bases apart, in either case
+enum Nucleotide
+{
+	adenine, cytosine, thymine, guanine,
+};
+
+// All four transitions of a branched node fit in one 16-byte block, which never outgrows its
+// size. A node with a single edge keeps it inline, like the generic node, so a node takes
+// 8 bytes plus a block only if it has more than one edge.
+class NucleotideEdgeBlock
+{
+public:
+	static AllocatorPtr<NucleotideEdgeBlock> create()
+	{
+		Allocator<NucleotideEdgeBlock>& allocator = Allocator<NucleotideEdgeBlock>::get_instance();
+		AllocatorPtr<NucleotideEdgeBlock> result = allocator.alloc();
+		new(allocator.get(result.to_int())) NucleotideEdgeBlock;
+		return result;
+	}
+
+	Edge<Nucleotide> edges[4];
+};
+
+template <int alphabet_size>
+class Node<Nucleotide, alphabet_size>
+{
+public:
+	static AllocatorPtr<Node<Nucleotide>> create()
+	{
+		Allocator<Node<Nucleotide>>& allocator = Allocator<Node<Nucleotide>>::get_instance();
+		AllocatorPtr<Node<Nucleotide>> result = allocator.alloc();
+		new(allocator.get(result.to_int())) Node<Nucleotide>;
+		return result;
+	}
+
+	static void destroy(AllocatorPtr<Node<Nucleotide>> node)
+	{
+		if (node->edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			node->get_edge_block().free();
+		}
+		node.free();
+	}
+
+	Node() : suffix(0), edge_collection_type(EdgeCollectionType::empty_edge_collection)
+	{
+	}
+
+	int get_edge_count() const
+	{
+		if (edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			const Edge<Nucleotide>* edges = get_edge_block()->edges;
+			return edges[0].is_present() + edges[1].is_present() + edges[2].is_present() + edges[3].is_present();
+		}
+		return edge_collection_type;
+	}
+
+	void add_edge(Nucleotide label, AllocatorPtr<Node<Nucleotide>> exit_node, EdgeType type)
+	{
+		if (edge_collection_type == EdgeCollectionType::empty_edge_collection)
+		{
+			single_label = label;
+			single_edge_type = type;
+			ptr = exit_node.to_int();
+			edge_collection_type = EdgeCollectionType::single_edge;
+		}
+		else if (edge_collection_type == EdgeCollectionType::single_edge)
+		{
+			const AllocatorPtr<NucleotideEdgeBlock> block = NucleotideEdgeBlock::create();
+			block->edges[single_label] = Edge<Nucleotide>(ptr, (EdgeType)single_edge_type);
+			block->edges[label] = Edge<Nucleotide>(exit_node, type);
+			ptr = block.to_int();
+			edge_collection_type = EdgeCollectionType::edge_block;
+		}
+		else // (edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			get_edge_block()->edges[label] = Edge<Nucleotide>(exit_node, type);
+		}
+	}
+
+	void add_secondary_edges(const Node<Nucleotide>& node)
+	{
+		node.for_each_edge([this](const LabeledEdge<Nucleotide> edge)
+		{
+			add_edge(edge.label, edge.edge.get_exit_node(), EdgeType::secondary);
+		});
+	}
+
+	template <typename Function>
+	void for_each_edge(Function function) const
+	{
+		if (edge_collection_type == EdgeCollectionType::single_edge)
+		{
+			function(LabeledEdge<Nucleotide>(Edge<Nucleotide>(ptr, (EdgeType)single_edge_type), (Nucleotide)single_label));
+		}
+		else if (edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			const Edge<Nucleotide>* edges = get_edge_block()->edges;
+			for (int i = 0; i < 4; i++)
+			{
+				if (edges[i].is_present())
+				{
+					function(LabeledEdge<Nucleotide>(edges[i], (Nucleotide)i));
+				}
+			}
+		}
+	}
+
+	void set_outgoing_edge_props(Nucleotide label, EdgeType edge_type, AllocatorPtr<Node<Nucleotide>> exit_node)
+	{
+		if (edge_collection_type == EdgeCollectionType::single_edge)
+		{
+			assert(single_label == (unsigned int)label);
+			single_edge_type = edge_type;
+			ptr = exit_node.to_int();
+		}
+		else // (edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			get_edge_block()->edges[label] = Edge<Nucleotide>(exit_node, edge_type);
+		}
+	}
+
+	const Edge<Nucleotide> get_outgoing_edge(Nucleotide letter) const
+	{
+		if (edge_collection_type == EdgeCollectionType::edge_block)
+		{
+			return get_edge_block()->edges[letter];
+		}
+		else if (edge_collection_type == EdgeCollectionType::single_edge && single_label == (unsigned int)letter)
+		{
+			return Edge<Nucleotide>(ptr, (EdgeType)single_edge_type);
+		}
+		return Edge<Nucleotide>::non_existant();
+	}
+
+	void set_suffix(AllocatorPtr<Node<Nucleotide>> suffix)
+	{
+		this->suffix = suffix.to_int();
+	}
+
+	AllocatorPtr<Node<Nucleotide>> get_suffix() const
+	{
+		return suffix;
+	}
+private:
+	enum EdgeCollectionType
+	{
+		empty_edge_collection, single_edge, edge_block,
+	};
+
+	AllocatorPtr<NucleotideEdgeBlock> get_edge_block() const
+	{
+		return (int)ptr;
+	}
+
+	unsigned long long suffix : 29;
+	unsigned long long edge_collection_type : 2;
+	unsigned long long single_label : 2;
+	unsigned long long single_edge_type : 1;
+	unsigned long long ptr : 29; // the exit node of a single edge, or the edge block
+};
+
+template <>
+inline Nucleotide Dawg<Nucleotide>::to_letter(char c)
+{
+	return (Nucleotide)((c >> 1) & 3);
+}
+
+// Streams a FASTA file into a sink with append(Nucleotide) and begin_segment(), such as
+// Dawg<Nucleotide>. Header lines and line breaks are skipped. Every record, and every run of
+// bases after an N (or any other ambiguity code), is a segment of its own, so that no substring
+// spans the gap.
+class FastaReader
+{
+public:
+	FastaReader() : base_count(0), record_count(0), segment_count(0)
+	{
+	}
+
+	// "-" reads stdin. Returns false if the file cannot be opened.
+	template <typename Sink>
+	bool read_file(const char* const filename, Sink& sink)
+	{
+		const int fd = strcmp(filename, "-") == 0 ? 0 : open_for_reading(filename);
+		if (fd == -1)
+		{
+			return false;
+		}
+
+		char buffer[1 << 16];
+		bool is_in_header = false;
+		bool is_segment_open = false;
+		int size;
+		while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				const char c = buffer[i];
+				if (is_in_header)
+				{
+					is_in_header = c != '\n';
+				}
+				else if (is_base(c))
+				{
+					if (is_segment_open == false)
+					{
+						if (segment_count > 0)
+						{
+							sink.begin_segment();
+						}
+						is_segment_open = true;
+						++segment_count;
+					}
+					sink.append(Dawg<Nucleotide>::to_letter(c));
+					++base_count;
+				}
+				else if (c == '>')
+				{
+					is_in_header = true;
+					is_segment_open = false;
+					++record_count;
+				}
+				else if (c != '\n' && c != '\r' && c != ' ' && c != '\t')
+				{
+					is_segment_open = false;
+				}
+			}
+		}
+		close(fd);
+		return true;
+	}
+
+	long long get_base_count() const
+	{
+		return base_count;
+	}
+
+	int get_record_count() const
+	{
+		return record_count;
+	}
+
+	int get_segment_count() const
+	{
+		return segment_count;
+	}
+private:
+	static bool is_base(char c)
+	{
+		switch (c | 0x20)
+		{
+		case 'a': case 'c': case 'g': case 't':
+			return true;
+		default:
+			return false;
+		}
+	}
+
+#ifdef WIN32
+	static int open_for_reading(const char* const filename)
+	{
+		return open(filename, O_RDONLY | O_BINARY | O_SEQUENTIAL);
+	}
+#else
+	static int open_for_reading(const char* const filename)
+	{
+		return open(filename, O_RDONLY);
+	}
+#endif
+
+	long long base_count;
+	int record_count;
+	int segment_count;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+
+#include "dawg.hpp"
+
+struct Lz77Phrase
+{
+	int offset; // distance back to the start of the earlier occurrence; 0 for a literal
+	int length; // 0 for a literal
+	char literal;
+};
+
+// Computes the LZ77 factorization while building the automaton in the same pass.
+// Each phrase is the longest prefix of the remaining text that starts at an earlier position
+// (it may overlap itself), or a single literal letter if there is no such prefix.
+template <typename CharType>
+class Lz77Factorizer : public DawgObserver
+{
+public:
+	Lz77Factorizer() : matched_node(0)
+	{
+	}
+
+	// The sink is called with every phrase as soon as it is complete
+	template <typename Sink>
+	void factorize(const char* const text, Sink& sink)
+	{
+		Dawg<CharType> dawg;
+		int position = 0;
+		while (text[position])
+		{
+			const int phrase_start = position;
+			matched_node = dawg.get_source_node();
+			while (text[position])
+			{
+				const CharType letter = Dawg<CharType>::to_letter(text[position]);
+				const Edge<CharType> edge = matched_node->get_outgoing_edge(letter);
+				if (edge.is_present() == false)
+				{
+					break;
+				}
+				matched_node = edge.get_exit_node();
+				append(dawg, letter, position);
+				++position;
+			}
+
+			Lz77Phrase phrase;
+			phrase.length = position - phrase_start;
+			if (phrase.length == 0)
+			{
+				phrase.offset = 0;
+				phrase.literal = text[position];
+				append(dawg, Dawg<CharType>::to_letter(text[position]), position);
+				++position;
+			}
+			else
+			{
+				const int occurrence_start = end_positions[matched_node.to_int()] - phrase.length + 1;
+				phrase.offset = phrase_start - occurrence_start;
+				phrase.literal = 0;
+			}
+			sink(phrase);
+		}
+	}
+
+	// A clone has the same first occurrence as the node it was split from
+	void on_split(AllocatorPtr<Node<CharType>> child_node, AllocatorPtr<Node<CharType>> new_child_node)
+	{
+		set_end_position(new_child_node, end_positions[child_node.to_int()]);
+		if (child_node == matched_node)
+		{
+			matched_node = new_child_node;
+		}
+	}
+private:
+	void append(Dawg<CharType>& dawg, CharType letter, int position)
+	{
+		dawg.append(letter, *this);
+		set_end_position(dawg.get_active_node(), position);
+	}
+
+	void set_end_position(AllocatorPtr<Node<CharType>> node, int position)
+	{
+		const unsigned int index = node.to_int();
+		if (index >= end_positions.size())
+		{
+			end_positions.resize(2 * index + 1);
+		}
+		end_positions[index] = position;
+	}
+
+	// The position of the last letter of the first occurrence of each node's strings
+	std::vector<int> end_positions;
+	AllocatorPtr<Node<CharType>> matched_node;
+};
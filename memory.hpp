@@ -1,5 +1,13 @@
 #pragma once
 
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
 template <typename T> class AllocatorPtr;
 template <typename T, int chunk_size = 8 * 1024 * 1024, int max_chunks = 64> class ChunkedAllocator; // 6 + 23 = 29 bits for addressing
 
@@ -60,6 +68,8 @@ class ChunkedAllocator
 public:
 	friend class NodeStatsBuilder;
 
+	static const int change_block_size = 1 << 16; // in items; divides the chunk size
+
 	const AllocatorPtr<T> alloc()
 	{
 		if (free_list_head)
@@ -68,23 +78,30 @@ public:
 			T* chunk = get(free_list_head);
 			free_list_head = *((int*)chunk);
 			++allocations_count;
+			mark_changed(result.to_int());
 			return result;
 		}
-		if (allocations_count % chunk_size == 0)
+		if (reserved_count == chunk_counter * chunk_size)
 		{
-			assert(chunk_counter < max_chunks);
-			memory_chunks[chunk_counter] = (T*)malloc(chunk_size * sizeof(T));
-			++chunk_counter;
+			add_chunk();
 		}
-		const AllocatorPtr<T> result = allocations_count;
+		const AllocatorPtr<T> result = reserved_count;
+		++reserved_count;
 		++allocations_count;
+		mark_changed(result.to_int());
 		return result;
 	}
 
 	void free(AllocatorPtr<T> ptr)
 	{
 		--allocations_count;
+		if (is_deferring_frees)
+		{
+			deferred_frees.push_back(ptr.to_int());
+			return;
+		}
 		int* item = (int*)get(ptr.to_int());
+		mark_changed(ptr.to_int());
 		*item = free_list_head;
 		free_list_head = ptr.to_int();
 	}
@@ -100,36 +117,194 @@ public:
 	bool is_valid(int index)
 	{
 		int chunk_index = index / chunk_size;
-		return chunk_index < chunk_counter && index <= allocations_count;
+		return chunk_index < chunk_counter && index <= reserved_count;
 	}
 
 	static ChunkedAllocator<T, chunk_size, max_chunks>& get_instance()
 	{
+		if (thread_instance)
+		{
+			return *thread_instance;
+		}
 		static ChunkedAllocator<T, chunk_size, max_chunks> instance;
 		return instance;
 	}
 
+	// Makes get_instance() return the given allocator on the calling thread; 0 brings back the shared one
+	static void bind_to_thread(ChunkedAllocator<T, chunk_size, max_chunks>* instance)
+	{
+		thread_instance = instance;
+	}
+
+	// Forgets all items but keeps the chunks for the items to come
+	void reset()
+	{
+		free_list_head = 0;
+		allocations_count = 0;
+		reserved_count = 0;
+		alloc(); // create a NULL pointer for this allocator
+	}
+
 	int get_allocations_count() const
 	{
 		return allocations_count;
 	}
-private:
+
+	// Unlike the allocations count this also includes the slots sitting in the free list
+	int get_reserved_count() const
+	{
+		return reserved_count;
+	}
+
+	int get_free_list_head() const
+	{
+		return free_list_head;
+	}
+
+	// Calls function(index) for every item in the free list
+	template <typename Function>
+	void for_each_free(Function function) const
+	{
+		for (int index = free_list_head; index != 0; index = *(int*)get(index))
+		{
+			function(index);
+		}
+	}
+
+	// Readers on other threads may still be looking at freed items (see concurrent.hpp). While frees
+	// are deferred, the items are collected untouched instead of going to the free list, until they
+	// are handed back to release_deferred_frees().
+	void set_deferring_frees(bool is_deferring)
+	{
+		is_deferring_frees = is_deferring;
+	}
+
+	std::vector<int> take_deferred_frees()
+	{
+		std::vector<int> result;
+		result.swap(deferred_frees);
+		return result;
+	}
+
+	void release_deferred_frees(const std::vector<int>& items)
+	{
+		for (const int index : items)
+		{
+			mark_changed(index);
+			*(int*)get(index) = free_list_head;
+			free_list_head = index;
+		}
+	}
+
+	// Checkpoints (see checkpoint.hpp) only save the blocks of items written to since the previous one.
+	// While changes are tracked, alloc() and free() mark the items they hand out and take back, and
+	// the owners of the items mark the ones they change in place.
+	void set_tracking_changes(bool is_tracking)
+	{
+		changed_blocks.assign(is_tracking ? (long long)max_chunks * chunk_size / change_block_size + 1 : 0, false);
+		is_tracking_changes = is_tracking;
+	}
+
+	void mark_changed(int index)
+	{
+		if (is_tracking_changes)
+		{
+			changed_blocks[index / change_block_size] = true;
+		}
+	}
+
+	// Returns whether an item of the block was marked since the last call
+	bool take_change(int block)
+	{
+		const bool result = changed_blocks[block] != 0;
+		changed_blocks[block] = false;
+		return result;
+	}
+
+	// Brings back the counters of a saved allocator; the items are restored through get()
+	void restore(int reserved_count, int allocations_count, int free_list_head)
+	{
+		while (chunk_counter * chunk_size < reserved_count)
+		{
+			add_chunk();
+		}
+		this->reserved_count = reserved_count;
+		this->allocations_count = allocations_count;
+		this->free_list_head = free_list_head;
+	}
+
+	// Besides the shared instance, threads may own allocators of their own (see bind_to_thread)
 	ChunkedAllocator()
-		: chunk_counter(0), free_list_head(0), allocations_count(0)
+		: chunk_counter(0), free_list_head(0), allocations_count(0), reserved_count(0), is_deferring_frees(false), is_tracking_changes(false)
 	{
 		alloc(); // create a NULL pointer for this allocator
 	}
 
+	ChunkedAllocator(const ChunkedAllocator<T, chunk_size, max_chunks>&) = delete;
+
 	~ChunkedAllocator()
 	{
 		for (int i = 0; i < chunk_counter; i++)
 		{
-			::free(memory_chunks[i]);
+			free_chunk(memory_chunks[i]);
 		}
 	}
+private:
+	// Items are addressed with 29 bits, so a build that outgrows the last chunk cannot go on
+	void add_chunk()
+	{
+		if (chunk_counter == max_chunks)
+		{
+			fprintf(stderr, "The automaton needs more than %d items of %d bytes\n", max_chunks * chunk_size, (int)sizeof(T));
+			exit(1);
+		}
+		T* const chunk = allocate_chunk();
+		if (chunk == 0)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		memory_chunks[chunk_counter] = chunk;
+		++chunk_counter;
+	}
+
+	// Chunks start at a cache line boundary, so items whose size divides 64 never straddle two lines
+#ifdef WIN32
+	static T* allocate_chunk()
+	{
+		return (T*)_aligned_malloc(chunk_size * sizeof(T), 64);
+	}
+
+	static void free_chunk(T* chunk)
+	{
+		_aligned_free(chunk);
+	}
+#else
+	static T* allocate_chunk()
+	{
+		void* result = 0;
+		posix_memalign(&result, 64, chunk_size * sizeof(T));
+		return (T*)result;
+	}
+
+	static void free_chunk(T* chunk)
+	{
+		::free(chunk);
+	}
+#endif
 
 	int chunk_counter;
 	int free_list_head;
 	int allocations_count;
+	int reserved_count;
+	bool is_deferring_frees;
+	std::vector<int> deferred_frees;
+	bool is_tracking_changes;
+	std::vector<char> changed_blocks;
 	T* memory_chunks[max_chunks];
+
+	static thread_local ChunkedAllocator<T, chunk_size, max_chunks>* thread_instance;
 };
+
+template <typename T, int chunk_size, int max_chunks>
+thread_local ChunkedAllocator<T, chunk_size, max_chunks>* ChunkedAllocator<T, chunk_size, max_chunks>::thread_instance = 0;
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+#include "parallel.hpp"
+
+// Minimal absent words and minimal unique substrings, read off the automaton in linear time.
+//
+// The shortest string of node p is cu, where c is a letter and u is the longest string of
+// suffix(p). For every letter b that suffix(p) has an edge for and p has not, cub is absent while
+// both cu and ub occur, so it is a minimal absent word; every minimal absent word arises once so.
+// The letters are those of the text.
+//
+// A minimal unique substring occurs once while its longest proper prefix and suffix occur at least
+// twice. It is the shortest string of a node p that occurs once, whose suffix(p) occurs at least
+// twice, and whose prefix is in the node r of an edge r -> p with length(suffix(r)) <
+// length(suffix(p)) <= length(r) that occurs at least twice. The shortest unique substring
+// covering a position is the shortest minimal unique substring covering it.
+template <typename CharType>
+class MinimalWords
+{
+public:
+	// Lengths, occurrence counts and first occurrences take one pass over the nodes in order of length
+	MinimalWords(const Dawg<CharType>& dawg, int thread_count) : thread_count(thread_count), source(dawg.get_source_node().to_int())
+	{
+		// Index 0 is the source's null suffix, with length -1
+		const int node_count = Allocator<Node<CharType>>::get_instance().get_reserved_count();
+		lengths.assign(node_count, -1);
+		suffixes.assign(node_count, 0);
+		counts.assign(node_count, 0);
+		first_ends.assign(node_count, INT_MAX);
+		std::vector<int> parents(node_count, 0);
+		std::vector<CharType> labels(node_count, 0);
+
+		// The primary edges form a spanning tree in which a node's depth is its length,
+		// so a breadth-first walk of it yields the nodes by increasing length
+		std::vector<int> order(1, source);
+		lengths[source] = 0;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			const int node = order[i];
+			AllocatorPtr<Node<CharType>>(node)->for_each_edge([this, node, &order, &parents, &labels](const LabeledEdge<CharType> edge)
+			{
+				if (edge.edge.get_type() == EdgeType::primary)
+				{
+					const int child = edge.edge.get_exit_node().to_int();
+					lengths[child] = lengths[node] + 1;
+					suffixes[child] = AllocatorPtr<Node<CharType>>(child)->get_suffix().to_int();
+					parents[child] = node;
+					labels[child] = edge.label;
+					order.push_back(child);
+				}
+			});
+		}
+
+		// Every prefix of the text ends in its own node, on the primary path to the active node,
+		// and a node's strings occur wherever the strings of the nodes it is the suffix of do
+		const int active_node = dawg.get_active_node().to_int();
+		text.resize(lengths[active_node]);
+		for (int node = active_node; node != source; node = parents[node])
+		{
+			counts[node] = 1;
+			first_ends[node] = lengths[node] - 1;
+			text[lengths[node] - 1] = 0x60 | labels[node];
+		}
+		for (size_t i = order.size() - 1; i > 0; i--)
+		{
+			const int node = order[i];
+			counts[suffixes[node]] += counts[node];
+			first_ends[suffixes[node]] = std::min(first_ends[suffixes[node]], first_ends[node]);
+		}
+		counts[source] = lengths[active_node] + 1;
+	}
+
+	// Calls sink(word, length) for every minimal absent word with a length in [min_length, max_length]
+	template <typename Sink>
+	void for_each_absent_word(int min_length, int max_length, Sink& sink) const
+	{
+		check_nodes(sink, [this, min_length, max_length](int node, std::string& output)
+		{
+			const int suffix = suffixes[node];
+			const int length = lengths[suffix] + 2;
+			if (node == source || length < min_length || length > max_length)
+			{
+				return;
+			}
+			const AllocatorPtr<Node<CharType>> node_ptr = node;
+			AllocatorPtr<Node<CharType>>(suffix)->for_each_edge([this, node, node_ptr, &output](const LabeledEdge<CharType> edge)
+			{
+				if (node_ptr->get_outgoing_edge(edge.label).is_present() == false)
+				{
+					append_shortest(node, output);
+					output.push_back(0x60 | edge.label);
+					output.push_back('\n');
+				}
+			});
+		});
+	}
+
+	// Calls sink(word, length) for every minimal unique substring with a length in [min_length, max_length]
+	template <typename Sink>
+	void for_each_unique_substring(int min_length, int max_length, Sink& sink) const
+	{
+		check_nodes(sink, [this, min_length, max_length](int node, std::string& output)
+		{
+			if (counts[node] < 2)
+			{
+				return;
+			}
+			const int minimum_suffix_length = lengths[suffixes[node]];
+			AllocatorPtr<Node<CharType>>(node)->for_each_edge([this, node, minimum_suffix_length, min_length, max_length, &output](const LabeledEdge<CharType> edge)
+			{
+				const int child = edge.edge.get_exit_node().to_int();
+				const int suffix_length = lengths[suffixes[child]];
+				const int length = suffix_length + 1;
+				if (counts[child] == 1 && counts[suffixes[child]] >= 2 && minimum_suffix_length < suffix_length && suffix_length <= lengths[node]
+					&& length >= min_length && length <= max_length)
+				{
+					append_shortest(child, output);
+					output.push_back('\n');
+				}
+			});
+		});
+	}
+private:
+	// Runs check(node, output) on consecutive batches of nodes, each split in ranges checked in
+	// parallel, and passes each range's words to the sink in order, so the output is the same
+	// for any thread count and only one batch of it is buffered at a time. The nodes are taken
+	// in allocator order, which keeps most of the accesses sequential.
+	template <typename Sink, typename Check>
+	void check_nodes(Sink& sink, Check check) const
+	{
+		const int batch_size = thread_count << 16;
+		std::vector<std::string> outputs(thread_count);
+		for (int first = 1; first < (int)lengths.size(); first += batch_size)
+		{
+			const int last = std::min((int)lengths.size(), first + batch_size);
+			parallel_for(first, last, thread_count, [this, &outputs, &check](int range, int begin, int end)
+			{
+				std::string& output = outputs[range];
+				output.clear();
+				for (int node = begin; node < end; node++)
+				{
+					if (lengths[node] >= 0)
+					{
+						check(node, output);
+					}
+				}
+			});
+			for (const std::string& output : outputs)
+			{
+				for (size_t begin = 0, end; begin < output.size(); begin = end + 1)
+				{
+					end = output.find('\n', begin);
+					sink(output.data() + begin, (int)(end - begin));
+				}
+			}
+		}
+	}
+
+	void append_shortest(int node, std::string& output) const
+	{
+		const int length = lengths[suffixes[node]] + 1;
+		output.append(text, first_ends[node] - length + 1, length);
+	}
+
+	const int thread_count;
+	const int source;
+	std::vector<int> lengths;
+	std::vector<int> suffixes;
+	std::vector<int> counts;
+	std::vector<int> first_ends; // where the first occurrence of each node's strings ends
+	std::string text;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstring>
 #include <new>
 #include "memory.hpp"
 
@@ -8,7 +10,11 @@ template <typename CharType> class Edge;
 template <typename CharType> class LabeledEdge;
 template <typename CharType> class EmptyEdgeCollection;
 template <typename CharType> class SingleEdgeCollection;
+#ifdef WIDE_NODES
+template <typename CharType, int max_list_size = 4> class PartialEdgeList;
+#else
 template <typename CharType, int max_list_size = 3> class PartialEdgeList;
+#endif
 template <typename CharType, int alphabet_size> class FullEdgeMap;
 
 enum EdgeType
@@ -16,8 +22,51 @@ enum EdgeType
 	primary, secondary,
 };
 
+template <int size> struct WordOfSize;
+template <> struct WordOfSize<1> { typedef unsigned char type; };
+template <> struct WordOfSize<4> { typedef unsigned int type; };
+template <> struct WordOfSize<8> { typedef unsigned long long type; };
+
+// Readers on other threads (see concurrent.hpp) may load a word of the automaton while the
+// writer replaces it, so such words are stored and loaded whole. The release store also makes
+// whatever the writer stored before, such as a container the word now points to, visible to
+// a reader that loads the word.
+template <typename T>
+void publish(T& target, const T& value)
+{
+	typedef typename WordOfSize<sizeof(T)>::type Word;
+	Word word;
+	memcpy(&word, &value, sizeof(word));
+	reinterpret_cast<std::atomic<Word>&>(target).store(word, std::memory_order_release);
+}
+
+template <typename T>
+T load_published(const T& source)
+{
+	typedef typename WordOfSize<sizeof(T)>::type Word;
+	const Word word = reinterpret_cast<const std::atomic<Word>&>(source).load(std::memory_order_acquire);
+	T result;
+	memcpy((void*)&result, &word, sizeof(result));
+	return result;
+}
+
+// The first word of a node: everything but the inline edges of wide nodes. Changes to it are
+// made on a copy, which then replaces it with one store.
+class NodeFields
+{
+public:
+	NodeFields() : suffix(0), ptr_type(0)
+	{
+	}
+
+	unsigned long long suffix : 29;
+	unsigned long long ptr_type : 5;
+	unsigned long long outgoing_edge_type : 1;
+	unsigned long long ptr : 29;
+};
+
 template <typename CharType, int alphabet_size>
-class Node
+class Node : protected NodeFields
 {
 public:
 	static AllocatorPtr<Node<CharType>> create()
@@ -28,7 +77,13 @@ public:
 		return result;
 	}
 
-	Node() : ptr_type(0)
+	static void destroy(AllocatorPtr<Node<CharType>> node)
+	{
+		node->~Node<CharType>();
+		node.free();
+	}
+
+	Node()
 	{
 	}
 
@@ -42,9 +97,8 @@ public:
 		}
 		else if (is_of_type(EdgeCollectionType::partial_edge_list))
 		{
-			Allocator<PartialEdgeList<CharType, alphabet_size>>& allocator = Allocator<PartialEdgeList<CharType, alphabet_size>>::get_instance();
 			ptr_to_partial_edge_list().~PartialEdgeList<CharType>();
-			allocator.free(ptr);
+			free_partial_edge_list(ptr);
 		}
 	}
 
@@ -77,15 +131,14 @@ public:
 		}
 		else if (is_of_type(EdgeCollectionType::single_node))
 		{
-			AllocatorPtr<PartialEdgeList<CharType>> new_edges_ptr = PartialEdgeList<CharType>::create();
-			PartialEdgeList<CharType>& new_edges = *new_edges_ptr;
+			NodeFields fields = *this;
+			PartialEdgeList<CharType>& new_edges = create_partial_edge_list(fields);
 
 			new_edges.add_edge(ptr_type, ptr, (EdgeType)outgoing_edge_type);
 			new_edges.add_edge(label, exit_node, type);
 
-			ptr = new_edges_ptr.to_int();
-
-			set_edge_collection_type(EdgeCollectionType::partial_edge_list);
+			fields.ptr_type = EdgeCollectionType::partial_edge_list;
+			set_fields(fields);
 		}
 		else if (is_of_type(EdgeCollectionType::partial_edge_list))
 		{
@@ -98,11 +151,13 @@ public:
 				new_edges.add_edges(edges);
 				new_edges.add_edge(label, exit_node, type);
 
-				AllocatorPtr<PartialEdgeList<CharType>> old_ptr = ptr;
-				ptr = new_edges_ptr.to_int();
-				old_ptr.free();
-
-				set_edge_collection_type(EdgeCollectionType::full_edge_map);
+				// Readers may still be in the old list, which is only freed once it is unreachable
+				const AllocatorPtr<PartialEdgeList<CharType>> old_edges_ptr = ptr;
+				NodeFields fields = *this;
+				fields.ptr = new_edges_ptr.to_int();
+				fields.ptr_type = EdgeCollectionType::full_edge_map;
+				set_fields(fields);
+				free_partial_edge_list(old_edges_ptr);
 			}
 			else
 			{
@@ -143,6 +198,53 @@ public:
 		}
 	}
 
+	// Moves the edges of the given node to this one, which has none, leaving the given node without edges
+	void take_edges(Node<CharType>& node)
+	{
+		assert(is_of_type(EdgeCollectionType::empty_edge_collection));
+#ifdef WIDE_NODES
+		inline_edges = node.inline_edges;
+#endif
+		NodeFields fields = *this;
+		fields.ptr_type = node.ptr_type;
+		fields.outgoing_edge_type = node.outgoing_edge_type;
+		fields.ptr = node.ptr;
+		set_fields(fields);
+
+		NodeFields node_fields = node;
+		node_fields.ptr_type = EdgeCollectionType::empty_edge_collection;
+		node_fields.outgoing_edge_type = 0;
+		node_fields.ptr = 0;
+		node.set_fields(node_fields);
+	}
+
+	template <typename Function>
+	void for_each_edge(Function function) const
+	{
+		if (is_of_type(EdgeCollectionType::empty_edge_collection))
+		{
+			// Do nothing
+		}
+		else if (is_of_type(EdgeCollectionType::single_node))
+		{
+			function(LabeledEdge<CharType>(Edge<CharType>(ptr, (EdgeType)outgoing_edge_type), ptr_type));
+		}
+		else if (is_of_type(EdgeCollectionType::partial_edge_list))
+		{
+			for (const LabeledEdge<CharType> edge : ptr_to_partial_edge_list())
+			{
+				function(edge);
+			}
+		}
+		else // (is_of_type(EdgeCollectionType::full_edge_map))
+		{
+			for (const LabeledEdge<CharType> edge : ptr_to_full_edge_map())
+			{
+				function(edge);
+			}
+		}
+	}
+
 	void set_outgoing_edge_props(CharType label, EdgeType edge_type, AllocatorPtr<Node<CharType>> exit_node)
 	{
 		if (is_of_type(EdgeCollectionType::empty_edge_collection))
@@ -163,6 +265,21 @@ public:
 		}
 	}
 
+	// Marks the item holding the node's edges, if they live outside the node (see ChunkedAllocator::mark_changed)
+	void mark_edges_changed() const
+	{
+#ifndef WIDE_NODES
+		if (is_of_type(EdgeCollectionType::partial_edge_list))
+		{
+			Allocator<PartialEdgeList<CharType>>::get_instance().mark_changed(ptr);
+		}
+#endif
+		if (is_of_type(EdgeCollectionType::full_edge_map))
+		{
+			Allocator<FullEdgeMap<CharType, alphabet_size>>::get_instance().mark_changed(ptr);
+		}
+	}
+
 	const Edge<CharType> get_outgoing_edge(CharType letter)
 	{
 		if (is_of_type(EdgeCollectionType::empty_edge_collection))
@@ -183,9 +300,38 @@ public:
 		}
 	}
 
+	// Unlike get_outgoing_edge, safe while the writer changes the node (see concurrent.hpp).
+	// The node's fields are loaded once, so the edge collection is read as the writer left it.
+	const Edge<CharType> get_published_edge(CharType letter) const
+	{
+		const NodeFields fields = load_published<NodeFields>(*this);
+		if (fields.ptr_type == EdgeCollectionType::empty_edge_collection)
+		{
+			return Edge<CharType>::non_existant();
+		}
+		else if (fields.ptr_type <= EdgeCollectionType::single_node)
+		{
+			return fields.ptr_type == (unsigned int)letter ? Edge<CharType>(fields.ptr, (EdgeType)fields.outgoing_edge_type) : Edge<CharType>::non_existant();
+		}
+		else if (fields.ptr_type == EdgeCollectionType::partial_edge_list)
+		{
+#ifdef WIDE_NODES
+			return inline_edges.get_published_edge(letter);
+#else
+			return AllocatorPtr<PartialEdgeList<CharType>>(fields.ptr)->get_published_edge(letter);
+#endif
+		}
+		else // (fields.ptr_type == EdgeCollectionType::full_edge_map)
+		{
+			return AllocatorPtr<FullEdgeMap<CharType, alphabet_size>>(fields.ptr)->get_published_edge(letter);
+		}
+	}
+
 	void set_suffix(AllocatorPtr<Node<CharType>> suffix)
 	{
-		this->suffix = suffix.to_int();
+		NodeFields fields = *this;
+		fields.suffix = suffix.to_int();
+		set_fields(fields);
 	}
 
 	AllocatorPtr<Node<CharType>> get_suffix()
@@ -193,6 +339,19 @@ public:
 		return suffix;
 	}
 
+	// Dictionary automata have no suffix links, so their nodes keep the final flag in its place
+	void set_final(bool is_final)
+	{
+		NodeFields fields = *this;
+		fields.suffix = is_final;
+		set_fields(fields);
+	}
+
+	bool is_final() const
+	{
+		return suffix != 0;
+	}
+
 	EmptyEdgeCollection<CharType>& ptr_to_empty_edge_collection()
 	{
 		assert(is_of_type(EdgeCollectionType::empty_edge_collection));
@@ -208,8 +367,12 @@ public:
 	PartialEdgeList<CharType>& ptr_to_partial_edge_list() const
 	{
 		assert(is_of_type(EdgeCollectionType::partial_edge_list));
+#ifdef WIDE_NODES
+		return inline_edges;
+#else
 		AllocatorPtr<PartialEdgeList<CharType>> result_ptr = ptr;
 		return *result_ptr;
+#endif
 	}
 
 	FullEdgeMap<CharType, alphabet_size>& ptr_to_full_edge_map() const
@@ -239,15 +402,40 @@ protected:
 		}
 	}
 
-	void set_edge_collection_type(EdgeCollectionType type)
+	void set_fields(const NodeFields& fields)
 	{
-		ptr_type = type;
+		publish<NodeFields>(*this, fields);
 	}
 
-	unsigned long long suffix : 29;
-	unsigned long long ptr_type : 5;
-	unsigned long long outgoing_edge_type : 1;
-	unsigned long long ptr : 29;
+#ifdef WIDE_NODES
+	// The list lives inside the node, which makes it 32 bytes and half a cache line.
+	// Lookups in nodes of up to 4 edges never leave the node.
+	PartialEdgeList<CharType>& create_partial_edge_list(NodeFields&)
+	{
+		return inline_edges;
+	}
+
+	void free_partial_edge_list(AllocatorPtr<PartialEdgeList<CharType>>)
+	{
+	}
+#else
+	// The new list is only linked into the given copy of the node's fields
+	PartialEdgeList<CharType>& create_partial_edge_list(NodeFields& fields)
+	{
+		AllocatorPtr<PartialEdgeList<CharType>> result_ptr = PartialEdgeList<CharType>::create();
+		fields.ptr = result_ptr.to_int();
+		return *result_ptr;
+	}
+
+	void free_partial_edge_list(AllocatorPtr<PartialEdgeList<CharType>> old_ptr)
+	{
+		old_ptr.free();
+	}
+#endif
+
+#ifdef WIDE_NODES
+	mutable PartialEdgeList<CharType> inline_edges;
+#endif
 };
 
 template <typename CharType>
@@ -327,9 +515,11 @@ public:
 
 	void add_edge(CharType letter, AllocatorPtr<Node<CharType>> exit_node, EdgeType type)
 	{
-		this->ptr_type = letter;
-		this->ptr = exit_node.to_int();
-		this->outgoing_edge_type = type;
+		NodeFields fields = *this;
+		fields.ptr_type = letter;
+		fields.ptr = exit_node.to_int();
+		fields.outgoing_edge_type = type;
+		this->set_fields(fields);
 	}
 
 	void set_edge_props(CharType, AllocatorPtr<Node<CharType>>, EdgeType)
@@ -373,8 +563,10 @@ public:
 	void set_edge_props([[maybe_unused]] CharType letter, AllocatorPtr<Node<CharType>> exit_node, EdgeType type)
 	{
 		assert(this->ptr_type == letter);
-		this->outgoing_edge_type = type;
-		this->ptr = exit_node.to_int();
+		NodeFields fields = *this;
+		fields.outgoing_edge_type = type;
+		fields.ptr = exit_node.to_int();
+		this->set_fields(fields);
 	}
 
 	int size() const
@@ -426,9 +618,10 @@ public:
 		assert(!is_full());
 		assert(get_edge_index(letter) == -1);
 
+		// A reader finds the edge by its label, so the label is stored last
 		int current_size = size();
-		label_data[current_size] = letter;
 		edges[current_size] = Edge<CharType>(exit_node, type);
+		publish<unsigned char>(label_data[current_size], letter);
 		++label_count;
 	}
 
@@ -437,7 +630,19 @@ public:
 		int edge_index = get_edge_index(letter);
 		assert(edge_index != -1);
 
-		edges[edge_index] = Edge<CharType>(exit_node, type);
+		publish(edges[edge_index], Edge<CharType>(exit_node, type));
+	}
+
+	const Edge<CharType> get_published_edge(CharType letter) const
+	{
+		for (int i = 0; i < max_list_size; i++)
+		{
+			if (load_published(label_data[i]) == letter)
+			{
+				return load_published(edges[i]);
+			}
+		}
+		return Edge<CharType>::non_existant();
 	}
 
 	int size() const
@@ -528,22 +733,27 @@ public:
 		return edges[letter - 1];
 	}
 
+	const Edge<CharType> get_published_edge(CharType letter) const
+	{
+		return load_published(edges[letter - 1]);
+	}
+
 	void add_edge(CharType letter, Edge<CharType> edge)
 	{
 		assert(edges[letter - 1].is_present() == false);
-		edges[letter - 1] = edge;
+		publish(edges[letter - 1], edge);
 	}
 
 	void add_edge(CharType letter, AllocatorPtr<Node<CharType>> exit_node, EdgeType type)
 	{
 		assert(edges[letter - 1].is_present() == false);
-		edges[letter - 1] = Edge<CharType>(exit_node, type);
+		publish(edges[letter - 1], Edge<CharType>(exit_node, type));
 	}
 
 	void set_edge_props(CharType letter, AllocatorPtr<Node<CharType>> exit_node, EdgeType type)
 	{
 		assert(edges[letter - 1].is_present());
-		edges[letter - 1] = Edge<CharType>(exit_node, type);
+		publish(edges[letter - 1], Edge<CharType>(exit_node, type));
 	}
 
 	int size()
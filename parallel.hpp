@@ -0,0 +1,31 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+
+inline int default_thread_count()
+{
+	const int result = std::thread::hardware_concurrency();
+	return result > 0 ? result : 1;
+}
+
+// Splits [begin, end) into range_count contiguous ranges of nearly equal size and calls
+// function(range_index, range_begin, range_end) for each of them on its own thread.
+// The first range runs on the calling thread.
+template <typename Function>
+void parallel_for(int begin, int end, int range_count, Function function)
+{
+	std::vector<std::thread> threads;
+	const long long size = end - begin;
+	for (int i = 1; i < range_count; i++)
+	{
+		const int range_begin = begin + (int)(size * i / range_count);
+		const int range_end = begin + (int)(size * (i + 1) / range_count);
+		threads.push_back(std::thread(function, i, range_begin, range_end));
+	}
+	function(0, begin, begin + (int)(size / range_count));
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+#include "dawg.hpp"
+
+// Estimates the code length of a text under a PPM model of order max_order (PPMC escapes, with
+// exclusion), as the text is appended to the automaton, without a separate modeling pass.
+//
+// The contexts of the next letter are the suffixes of the text, which lie on the suffix chain of the
+// active node. All strings of a node are followed by the same letters equally often: a context was
+// followed by a letter as many times as the node its edge leads to occurs, whether that edge is
+// primary or secondary. Only nodes whose shortest string has at most max_order + 1 letters need their
+// occurrences counted, so each letter adds one to at most max_order + 2 nodes at the tail of the
+// chain, and a node's shortest string never gets shorter. The letter is coded from the context of
+// max_order letters down, escaping from each context that has not seen it and excluding the letters of
+// the contexts escaped from; a letter that no context has seen is coded uniformly among the others.
+//
+// On text without structure the sparse high-order contexts keep escaping, so that PPM does worse than
+// the uniform code. The estimate mixes the two, weighted by how well each has predicted the text so
+// far, and is never more than about a bit in total above the better one: random text stays at
+// log2(alphabet_size) bits per letter, while the cost of repeated text goes towards 0.
+template <typename CharType>
+class PpmEstimator : public DawgObserver
+{
+public:
+	static const int alphabet_size = 26;
+	static const int max_order = 5;
+
+	PpmEstimator() : counted_node(dawg.get_source_node()), length(0), total_bits(0), model_odds(1)
+	{
+		get_statistics(dawg.get_source_node()) = Statistics { 0, 1 };
+	}
+
+	~PpmEstimator()
+	{
+		dawg.free();
+	}
+
+	// Returns the code length of the letter in bits
+	double append(CharType letter)
+	{
+		const double model_probability = get_model_probability(letter);
+		const double uniform_probability = 1.0 / alphabet_size;
+		const double model_weight = model_odds / (1 + model_odds);
+		const double letter_bits = -std::log2(model_weight * model_probability + (1 - model_weight) * uniform_probability);
+		const double odds_limit = (double)(1ULL << max_log_odds);
+		model_odds = std::min(std::max(model_odds * model_probability / uniform_probability, 1 / odds_limit), odds_limit);
+
+		const int active_length = get_statistics(dawg.get_active_node()).length;
+		dawg.append(letter, *this);
+		get_statistics(dawg.get_active_node()) = Statistics { active_length + 1, 0 };
+		count_occurrences(letter);
+
+		total_bits += letter_bits;
+		++length;
+		return letter_bits;
+	}
+
+	long long get_length() const
+	{
+		return length;
+	}
+
+	double get_total_bits() const
+	{
+		return total_bits;
+	}
+
+	double get_bits_per_letter() const
+	{
+		return length ? total_bits / length : 0;
+	}
+
+	// The clone takes over the shorter strings of the child, and with them its occurrences
+	void on_split(AllocatorPtr<Node<CharType>> child_node, AllocatorPtr<Node<CharType>> new_child_node)
+	{
+		const int count = get_statistics(child_node).count;
+		get_statistics(new_child_node).count = count;
+	}
+
+	// Sets the length of a clone, which is only known once the edge to it is primary
+	void on_predict(AllocatorPtr<Node<CharType>> node, AllocatorPtr<Node<CharType>> target_node)
+	{
+		const int target_length = get_statistics(node).length + 1;
+		get_statistics(target_node).length = target_length;
+	}
+private:
+	// Bounds the mixture weights to 2^±max_log_odds, so that either code can take over again after a
+	// long stretch of text
+	static const int max_log_odds = 32;
+
+	struct Statistics
+	{
+		int length; // of the node's longest string
+		int count; // of the node's occurrences, if its shortest string has at most max_order + 1 letters
+	};
+
+	// The probability of the letter under the PPM model, before the letter is appended. A context that
+	// ends the text has been followed by a letter once less than it occurs, and it has every letter
+	// of the longer contexts, so one pass over its edges looks up the counts of the excluded letters
+	// and of the coded one.
+	double get_model_probability(CharType letter)
+	{
+		const AllocatorPtr<Node<CharType>> source_node = dawg.get_source_node();
+		const AllocatorPtr<Node<CharType>> counted_suffix = counted_node->get_suffix();
+		AllocatorPtr<Node<CharType>> context = counted_suffix != 0 && get_statistics(counted_suffix).length >= max_order
+			? counted_suffix : counted_node;
+		int excluded_count = 0;
+		unsigned int excluded_mask = 0;
+		double probability = 1;
+		while (true)
+		{
+			Node<CharType>& node = *context;
+			int total = get_statistics(context).count - 1;
+			int letter_count = 0;
+			int letter_total = 0;
+			unsigned int letter_mask = 0;
+			node.for_each_edge([&](const LabeledEdge<CharType> edge)
+			{
+				if (excluded_mask & 1u << edge.label)
+				{
+					total -= get_statistics(edge.edge.get_exit_node()).count;
+				}
+				else
+				{
+					++letter_count;
+					letter_mask |= 1u << edge.label;
+					if (edge.label == letter)
+					{
+						letter_total = get_statistics(edge.edge.get_exit_node()).count;
+					}
+				}
+			});
+			if (letter_count > 0)
+			{
+				if (letter_total)
+				{
+					return probability * letter_total / (total + letter_count);
+				}
+				probability *= (double)letter_count / (total + letter_count);
+				excluded_count += letter_count;
+				excluded_mask |= letter_mask;
+			}
+			if (context == source_node)
+			{
+				return probability / std::max(alphabet_size - excluded_count, 1);
+			}
+			context = node.get_suffix();
+		}
+	}
+
+	// The number of times the node's strings were followed by the letter
+	int get_count(Node<CharType>& node, CharType letter)
+	{
+		const Edge<CharType> edge = node.get_outgoing_edge(letter);
+		return edge.is_present() ? get_statistics(edge.get_exit_node()).count : 0;
+	}
+
+	// Moves counted_node to the node of the text's last max_order + 1 letters, and counts an
+	// occurrence of it and of every node after it on the suffix chain
+	void count_occurrences(CharType letter)
+	{
+		if (length < max_order + 1)
+		{
+			counted_node = dawg.get_active_node();
+		}
+		else
+		{
+			// A split may have moved the counted strings to a clone, which is then the node's suffix
+			const AllocatorPtr<Node<CharType>> suffix = counted_node->get_suffix();
+			if (get_statistics(suffix).length >= max_order + 1)
+			{
+				counted_node = suffix;
+			}
+			const AllocatorPtr<Node<CharType>> next_node = counted_node->get_outgoing_edge(letter).get_exit_node();
+			const AllocatorPtr<Node<CharType>> next_suffix = next_node->get_suffix();
+			counted_node = get_statistics(next_suffix).length >= max_order + 1 ? next_suffix : next_node;
+		}
+		for (AllocatorPtr<Node<CharType>> node = counted_node; node != 0; node = node->get_suffix())
+		{
+			++get_statistics(node).count;
+		}
+	}
+
+	// Covers every node in the allocator and then some, so that references to the statistics stay
+	// valid until more nodes are created
+	Statistics& get_statistics(AllocatorPtr<Node<CharType>> node)
+	{
+		const int index = node.to_int();
+		if (index >= (int)statistics.size())
+		{
+			const size_t reserved_count = Allocator<Node<CharType>>::get_instance().get_reserved_count();
+			statistics.reserve(reserved_count + reserved_count / 2);
+			statistics.resize(statistics.capacity(), Statistics { 0, 0 });
+		}
+		return statistics[index];
+	}
+
+	Dawg<CharType> dawg;
+	AllocatorPtr<Node<CharType>> counted_node;
+	std::vector<Statistics> statistics;
+	long long length;
+	double total_bits;
+	double model_odds; // the PPM model's weight over the uniform code's
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "dawg.hpp"
+
+// Recognizes the subwords of the last window_size letters of an unbounded stream.
+// Two automata are rebuilt alternately: every window_size letters the older one is freed
+// and a fresh one is started. The older automaton therefore spans between window_size and
+// 2 * window_size - 1 letters, so it may also recognize subwords that have just left the
+// window. Freed nodes and edge collections go back to their allocators' free lists, which
+// keeps the memory proportional to window_size.
+template <typename CharType>
+class SlidingWindowDawg
+{
+public:
+	SlidingWindowDawg(int window_size)
+		: window_size(window_size), position(0), older(new Dawg<CharType>), newer(0), matched_node(older->get_source_node())
+	{
+		assert(window_size > 0);
+	}
+
+	SlidingWindowDawg(const SlidingWindowDawg<CharType>&) = delete;
+
+	~SlidingWindowDawg()
+	{
+		release(older);
+		if (newer)
+		{
+			release(newer);
+		}
+	}
+
+	void append(CharType letter)
+	{
+		older->append(letter);
+		if (newer)
+		{
+			newer->append(letter);
+		}
+		if (++position == window_size)
+		{
+			rotate();
+			position = 0;
+		}
+	}
+
+	// Approximate: true for every subword of the last window_size letters, but also for some that
+	// lie up to 2 * window_size - 1 letters back
+	bool contains(const CharType* letters, int length) const
+	{
+		return length <= window_size && older->contains(letters, length);
+	}
+
+	// Starts matching letters against the window as it is now, with the same approximation as
+	// contains(). The match is only valid until the next append().
+	void begin_match()
+	{
+		matched_node = older->get_source_node();
+	}
+
+	// Returns false, and leaves the match as it was, if the match followed by the letter does not occur
+	bool extend_match(CharType letter)
+	{
+		const Edge<CharType> edge = matched_node->get_outgoing_edge(letter);
+		if (edge.is_present() == false)
+		{
+			return false;
+		}
+		matched_node = edge.get_exit_node();
+		return true;
+	}
+private:
+	void rotate()
+	{
+		if (newer)
+		{
+			release(older);
+			older = newer;
+		}
+		newer = new Dawg<CharType>;
+	}
+
+	static void release(Dawg<CharType>* dawg)
+	{
+		dawg->free();
+		delete dawg;
+	}
+
+	const int window_size;
+	int position;
+	Dawg<CharType>* older;
+	Dawg<CharType>* newer;
+	AllocatorPtr<Node<CharType>> matched_node;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "memory.hpp"
+#include "nodes.hpp"
+
+// Recognizes the subwords of at most max_length letters of an unbounded stream. Its nodes are those
+// of the full automaton whose shortest string has at most max_length letters, each holding only its
+// strings of up to max_length letters. Every node then either holds a subword of max_length letters
+// of its own or is a subword that occurs after two different letters (or starts the stream), so
+// there are at most about twice as many nodes as distinct subwords of max_length letters, however
+// long the stream is.
+//
+// The update starts from the node of the last max_length - 1 letters instead of the node of the whole
+// stream, whose longer strings are not kept. Once the last max_length letters have occurred before,
+// nothing is added, and the update only follows an edge. A split that leaves the split node with only
+// its subword of max_length letters hands all of its edges to the clone, since from that subword they
+// would only lead to longer strings.
+template <typename CharType>
+class TruncatedDawg
+{
+public:
+	static const int length_limit = 255; // max_length must not exceed it, so that lengths fit in a byte
+
+	TruncatedDawg(int max_length) : max_length(max_length), source_ptr(create_node(0)), active_node_ptr(source_ptr)
+	{
+		assert(max_length > 0 && max_length <= length_limit);
+		source_ptr->set_suffix(0);
+	}
+
+	TruncatedDawg(const TruncatedDawg<CharType>&) = delete;
+
+	// Every node other than the source has exactly one incoming primary edge, as in Dawg::free
+	~TruncatedDawg()
+	{
+		std::vector<AllocatorPtr<Node<CharType>>> pending(1, source_ptr);
+		while (pending.empty() == false)
+		{
+			const AllocatorPtr<Node<CharType>> node_ptr = pending.back();
+			pending.pop_back();
+			node_ptr->for_each_edge([&pending](const LabeledEdge<CharType> edge)
+			{
+				if (edge.edge.get_type() == EdgeType::primary)
+				{
+					pending.push_back(edge.edge.get_exit_node());
+				}
+			});
+			Node<CharType>::destroy(node_ptr);
+		}
+	}
+
+	void append(CharType letter)
+	{
+		const Edge<CharType> edge = active_node_ptr->get_outgoing_edge(letter);
+		if (edge.is_present())
+		{
+			// The last max_length letters have occurred before, so they and their suffixes already have nodes
+			assert(edge.get_type() == EdgeType::primary);
+			active_node_ptr = shorten(edge.get_exit_node());
+			return;
+		}
+
+		const AllocatorPtr<Node<CharType>> new_node_ptr = create_node(std::min(get_length(active_node_ptr), max_length - 1) + 1);
+		active_node_ptr->add_edge(letter, new_node_ptr, EdgeType::primary);
+		AllocatorPtr<Node<CharType>> current_node_ptr = active_node_ptr;
+		AllocatorPtr<Node<CharType>> suffix_node = 0;
+		while (current_node_ptr != source_ptr && suffix_node == 0)
+		{
+			current_node_ptr = current_node_ptr->get_suffix();
+			Node<CharType>& current_node = *current_node_ptr;
+			const Edge<CharType> outgoing_edge = current_node.get_outgoing_edge(letter);
+			if (outgoing_edge.is_present() == false)
+			{
+				current_node.add_edge(letter, new_node_ptr, EdgeType::secondary);
+			}
+			else if (outgoing_edge.get_type() == EdgeType::primary)
+			{
+				suffix_node = outgoing_edge.get_exit_node();
+			}
+			else // (outgoing_edge.get_type() == EdgeType::secondary)
+			{
+				suffix_node = split(current_node_ptr, letter, outgoing_edge.get_exit_node());
+			}
+		}
+		new_node_ptr->set_suffix(suffix_node == 0 ? source_ptr : suffix_node);
+		active_node_ptr = shorten(new_node_ptr);
+	}
+
+	bool contains(const CharType* letters, int length) const
+	{
+		if (length > max_length)
+		{
+			return false;
+		}
+		AllocatorPtr<Node<CharType>> current_node_ptr = source_ptr;
+		for (int i = 0; i < length; i++)
+		{
+			const Edge<CharType> edge = current_node_ptr->get_outgoing_edge(letters[i]);
+			if (edge.is_present() == false)
+			{
+				return false;
+			}
+			current_node_ptr = edge.get_exit_node();
+		}
+		return true;
+	}
+private:
+	AllocatorPtr<Node<CharType>> create_node(int length)
+	{
+		const AllocatorPtr<Node<CharType>> result = Node<CharType>::create();
+		const int index = result.to_int();
+		if (index >= (int)lengths.size())
+		{
+			lengths.resize(index + index / 2 + 1);
+		}
+		lengths[index] = length;
+		return result;
+	}
+
+	int get_length(AllocatorPtr<Node<CharType>> node) const
+	{
+		return lengths[node.to_int()];
+	}
+
+	// Given the node of the last max_length letters (or of all of them, if there are fewer), returns the
+	// node of the last max_length - 1, which is its suffix if the node holds nothing shorter
+	AllocatorPtr<Node<CharType>> shorten(AllocatorPtr<Node<CharType>> node) const
+	{
+		const AllocatorPtr<Node<CharType>> suffix = node->get_suffix();
+		return get_length(suffix) == max_length - 1 ? suffix : node;
+	}
+
+	// The parent's secondary edge labeled label leads to child_node_ptr
+	AllocatorPtr<Node<CharType>> split(AllocatorPtr<Node<CharType>> parent_node_ptr, CharType label, AllocatorPtr<Node<CharType>> child_node_ptr)
+	{
+		const int new_length = get_length(parent_node_ptr) + 1;
+		const AllocatorPtr<Node<CharType>> new_child_node_ptr = create_node(new_length);
+		Node<CharType>& new_child_node = *new_child_node_ptr;
+		Node<CharType>& child_node = *child_node_ptr;
+
+		if (new_length == max_length - 1)
+		{
+			new_child_node.take_edges(child_node);
+		}
+		else
+		{
+			new_child_node.add_secondary_edges(child_node);
+		}
+		new_child_node.set_suffix(child_node.get_suffix());
+		parent_node_ptr->set_outgoing_edge_props(label, EdgeType::primary, new_child_node_ptr);
+		child_node.set_suffix(new_child_node_ptr);
+
+		AllocatorPtr<Node<CharType>> current_node_ptr = parent_node_ptr;
+		while (current_node_ptr != source_ptr)
+		{
+			current_node_ptr = current_node_ptr->get_suffix();
+			Node<CharType>& current_node = *current_node_ptr;
+			const Edge<CharType> edge = current_node.get_outgoing_edge(label);
+			if (edge.is_present() && edge.get_exit_node() == child_node_ptr)
+			{
+				current_node.set_outgoing_edge_props(label, EdgeType::secondary, new_child_node_ptr);
+			}
+			else
+			{
+				break;
+			}
+		}
+		return new_child_node_ptr;
+	}
+
+	const int max_length;
+	std::vector<unsigned char> lengths; // of the longest string of each node up to max_length letters, by allocator index
+	const AllocatorPtr<Node<CharType>> source_ptr;
+	AllocatorPtr<Node<CharType>> active_node_ptr; // the node of the last max_length - 1 letters
+};
+
+template <typename CharType>
+const int TruncatedDawg<CharType>::length_limit;